@@ -0,0 +1,510 @@
+/*--------------------------------------------------------------------*/
+/* Benchmarks for prog1.                                              */
+/*                                                                    */
+/* Usage:    prog1_bench [-p prog1path] [-l nlines] benchmark...      */
+/*                                                                    */
+/* Benchmarks:                                                        */
+/*   getline   read and analyze lines without executing them          */
+/*   spawn     run /bin/true once per line with each launch engine    */
+/*   builtin   run a builtin-only script, and the same script using   */
+/*             external programs                                      */
+/*   chain     run lines that are long && and || chains of builtins   */
+/*   pathmiss  run a command that isn't in any PATH directory         */
+/*   glob      expand a pattern in a directory of 20000 files         */
+/*   all       all of the above                                       */
+/*                                                                    */
+/* Each benchmark generates a command script, runs prog1 with the     */
+/* script as its standard input, and reports the elapsed time, lines  */
+/* per second, the number of read/write system calls and the CPU time */
+/* used by prog1 and its children per script line, and the number of  */
+/* context switches. The system call counts are taken from            */
+/* /proc/<pid>/io while prog1 is a zombie (that is, before it is      */
+/* reaped); the other figures come from the rusage returned by wait4. */
+/*                                                                    */
+/* Most benchmarks also measure the latency of single lines: prog1 is */
+/* run as a command server (-S), sent the line up to 10000 times, one */
+/* at a time, and the percentiles of the time until each reply        */
+/* arrives are reported.                                              */
+/*--------------------------------------------------------------------*/
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+
+#define NLATENCY 10000      /* max # of lines timed for latency */
+#define CHAINLEN 64         /* # of commands in a chain line */
+
+char *prog1 = "./prog1";    /* path to the shell being measured */
+int nlines = 100000;        /* # of lines in generated scripts */
+
+/*------------------------------------------------------------------*/
+/* The result of running prog1 once: elapsed time, read/write       */
+/* system call counts from /proc/<pid>/io, and resource usage.      */
+/*------------------------------------------------------------------*/
+struct result {
+    double secs;        /* elapsed (wall) time */
+    long syscr;         /* # of read system calls */
+    long syscw;         /* # of write system calls */
+    double cpu;         /* user + system time, with children */
+    long ctxsw;         /* # of context switches, with children */
+};
+
+/*----------------------------------------------------------*/
+/* Create a script named 'name' with nlines copies of 'cmd'. */
+/*----------------------------------------------------------*/
+void mkscript(char *name, char *cmd)
+{
+    FILE *sf;
+    int i;
+
+    sf = fopen(name,"w");
+    if (sf == NULL) {
+        fprintf(stderr,"Cannot create %s.\n", name);
+        exit(1);
+    }
+    for (i=0;i<nlines;i++)
+        fprintf(sf,"%s\n", cmd);
+    fclose(sf);
+}
+
+/*-------------------------------------------------------------------*/
+/* Get the syscr and syscw values from /proc/<pid>/io into r. Return */
+/* 0 on success, or -1 if the counts aren't available.               */
+/*-------------------------------------------------------------------*/
+int getio(pid_t pid, struct result *r)
+{
+    char name[64], key[32];
+    long v;
+    FILE *pf;
+
+    sprintf(name,"/proc/%d/io", (int)pid);
+    pf = fopen(name,"r");
+    if (pf == NULL)
+        return -1;
+    while (fscanf(pf,"%31[^:]: %ld\n", key, &v) == 2) {
+        if (!strcmp(key,"syscr"))
+            r->syscr = v;
+        else if (!strcmp(key,"syscw"))
+            r->syscw = v;
+    }
+    fclose(pf);
+    return 0;
+}
+
+/*--------------------------------------------------------------------*/
+/* Run prog1 with the options in opts (NULL terminated) and the named */
+/* script as its standard input. Its output is discarded.             */
+/*--------------------------------------------------------------------*/
+void run(char **opts, char *script, struct result *r)
+{
+    char *av[8];
+    int i, fd;
+    pid_t pid;
+    siginfo_t si;
+    struct timeval t0, t1;
+    struct rusage ru;
+
+    av[0] = prog1;
+    for (i=0;opts[i]!=NULL && i<6;i++)
+        av[i+1] = opts[i];
+    av[i+1] = NULL;
+
+    r->syscr = r->syscw = -1;
+    gettimeofday(&t0,NULL);
+    pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        fd = open(script,O_RDONLY);
+        if (fd == -1) {
+            perror(script);
+            _exit(1);
+        }
+        dup2(fd,0);
+        close(fd);
+        fd = open("/dev/null",O_WRONLY);
+        dup2(fd,1);
+        dup2(fd,2);
+        close(fd);
+        execv(prog1,av);
+        perror(prog1);
+        _exit(1);
+    }
+
+    /* Wait for prog1 to end, but leave it a zombie so /proc/<pid>/io stays. */
+    waitid(P_PID,pid,&si,WEXITED|WNOWAIT);
+    gettimeofday(&t1,NULL);
+    getio(pid,r);
+    wait4(pid,NULL,0,&ru);
+    r->secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1e6;
+
+    /* prog1's children have all been reaped, so their usage is included. */
+    r->cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6
+             + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+    r->ctxsw = ru.ru_nvcsw + ru.ru_nivcsw;
+}
+
+/*-----------------------------------------------*/
+/* Display one line of results for a benchmark. */
+/*-----------------------------------------------*/
+void report(char *name, struct result *r)
+{
+    printf("%-24s %8.3f s %10.0f lines/s %7.2f reads %7.2f writes "
+           "%8.2f us cpu %9ld ctxsw\n",
+           name, r->secs, nlines / r->secs, (double)r->syscr / nlines,
+           (double)r->syscw / nlines, r->cpu * 1e6 / nlines, r->ctxsw);
+}
+
+/*---------------------------------------------*/
+/* Compare two doubles for qsort.              */
+/*---------------------------------------------*/
+int dblcmp(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*------------------------------------------------------------------*/
+/* Read the reply to one command line from the prog1 server on s:   */
+/* a "<status> <n>" line, and n bytes of output, which are thrown   */
+/* away. Return 0 on success, or -1 if the connection failed.       */
+/*------------------------------------------------------------------*/
+int getreply(int s)
+{
+    char buf[4096];
+    int st, len, hlen;
+    long n;
+    char *nl;
+
+    hlen = 0;
+    for (;;) {              /* the header, and maybe some output */
+        len = read(s,buf+hlen,sizeof(buf)-1-hlen);
+        if (len <= 0)
+            return -1;
+        hlen += len;
+        buf[hlen] = '\0';
+        if ((nl = strchr(buf,'\n')) != NULL)
+            break;
+    }
+    if (sscanf(buf,"%d %ld", &st, &n) != 2)
+        return -1;
+    n -= hlen - (nl - buf + 1);
+    while (n > 0) {
+        len = read(s,buf,n < (long)sizeof(buf) ? n : (long)sizeof(buf));
+        if (len <= 0)
+            return -1;
+        n -= len;
+    }
+    return 0;
+}
+
+/*------------------------------------------------------------------*/
+/* Latency: start prog1 as a command server with the options in     */
+/* opts (NULL terminated), send it cmd as a line up to NLATENCY     */
+/* times, waiting for the reply each time, and display percentiles  */
+/* of the round-trip times.                                         */
+/*------------------------------------------------------------------*/
+void latency(char **opts, char *cmd)
+{
+    char *sock = "bench_prog1.sock";
+    char *av[12];
+    char *msg;
+    double *lat;
+    struct sockaddr_un sa;
+    struct timespec t0, t1;
+    int i, n, fd, s, len;
+    pid_t pid;
+
+    av[0] = prog1;
+    for (i=0;opts[i]!=NULL && i<8;i++)
+        av[i+1] = opts[i];
+    av[i+1] = "-S";
+    av[i+2] = sock;
+    av[i+3] = NULL;
+
+    unlink(sock);
+    pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        fd = open("/dev/null",O_WRONLY);
+        dup2(fd,1);
+        dup2(fd,2);
+        close(fd);
+        execv(prog1,av);
+        _exit(1);
+    }
+
+    memset(&sa,0,sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    strcpy(sa.sun_path,sock);
+    s = socket(AF_UNIX,SOCK_STREAM,0);
+    for (i=0;i<1000;i++) {      /* until the server is listening */
+        if (connect(s,(struct sockaddr *)&sa,sizeof(sa)) == 0)
+            break;
+        usleep(1000);
+    }
+    if (i == 1000) {
+        fprintf(stderr,"Cannot connect to %s -S.\n", prog1);
+        exit(1);
+    }
+
+    n = nlines < NLATENCY ? nlines : NLATENCY;
+    lat = malloc(n * sizeof(double));
+    len = strlen(cmd);
+    msg = malloc(len + 2);
+    sprintf(msg,"%s\n", cmd);
+    for (i=0;i<n;i++) {
+        clock_gettime(CLOCK_MONOTONIC,&t0);
+        if (write(s,msg,len+1) != len + 1 || getreply(s) == -1) {
+            fprintf(stderr,"Lost the connection to %s -S.\n", prog1);
+            exit(1);
+        }
+        clock_gettime(CLOCK_MONOTONIC,&t1);
+        lat[i] = (t1.tv_sec - t0.tv_sec) * 1e6
+                 + (t1.tv_nsec - t0.tv_nsec) / 1e3;
+    }
+    close(s);
+    kill(pid,SIGTERM);
+    waitpid(pid,NULL,0);
+    unlink(sock);
+
+    qsort(lat,n,sizeof(double),dblcmp);
+    printf("%-24s latency us: p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n", "",
+           lat[n/2], lat[n*9/10], lat[n*99/100], lat[n-1]);
+    free(lat);
+    free(msg);
+}
+
+/*------------------------------------------------------------------*/
+/* Getline benchmark: prog1 -n reads and analyzes every line of the */
+/* script but executes nothing, so the time and system calls are    */
+/* almost entirely those of Getline. The unbuffered (-u) run reads  */
+/* one character per system call, as Getline originally did.        */
+/*------------------------------------------------------------------*/
+void bgetline(void)
+{
+    char *script = "bench_getline.txt";
+    char *unbuf[] = { "-n", "-u", NULL };
+    char *buf[] = { "-n", NULL };
+    struct result r;
+
+    mkscript(script,"/bin/echo hello world && /bin/true || /bin/false");
+    run(unbuf,script,&r);
+    report("getline (unbuffered)",&r);
+    run(buf,script,&r);
+    report("getline (buffered)",&r);
+    latency(buf,"/bin/echo hello world && /bin/true || /bin/false");
+    unlink(script);
+}
+
+/*-------------------------------------------------------------------*/
+/* Spawn benchmark: every line runs /bin/true, so the time is mostly */
+/* that of creating and waiting for child processes, for each launch */
+/* engine (-e).                                                      */
+/*-------------------------------------------------------------------*/
+void bspawn(void)
+{
+    char *script = "bench_spawn.txt";
+    char *efork[] = { "-e", "fork", NULL };
+    char *espawn[] = { "-e", "spawn", NULL };
+    char *eserver[] = { "-e", "server", NULL };
+    struct result r;
+
+    mkscript(script,"/bin/true");
+    run(efork,script,&r);
+    report("spawn (fork)",&r);
+    latency(efork,"/bin/true");
+    run(espawn,script,&r);
+    report("spawn (posix_spawn)",&r);
+    latency(espawn,"/bin/true");
+    run(eserver,script,&r);
+    report("spawn (fork server)",&r);
+    latency(eserver,"/bin/true");
+    unlink(script);
+}
+
+/*------------------------------------------------------------------*/
+/* Builtin benchmark: the same && / || chain is run with builtins,  */
+/* and then with the equivalent external programs, to show the cost */
+/* of launching a process for trivial commands.                     */
+/*------------------------------------------------------------------*/
+void bbuiltin(void)
+{
+    char *script = "bench_builtin.txt";
+    char *none[] = { NULL };
+    struct result r;
+    double tb;
+
+    mkscript(script,"test -d / && true && false || echo ok");
+    run(none,script,&r);
+    report("builtin (in shell)",&r);
+    latency(none,"test -d / && true && false || echo ok");
+    tb = r.secs;
+    mkscript(script,"/bin/test -d / && /bin/true && /bin/false || /bin/echo ok");
+    run(none,script,&r);
+    report("builtin (external)",&r);
+    printf("%-24s %9.1f times faster with builtins\n", "", r.secs / tb);
+    unlink(script);
+}
+
+/*------------------------------------------------------------------*/
+/* Chain benchmark: every line is CHAINLEN builtins joined by && or */
+/* by ||, all of which are run, so the time is mostly that of lex,  */
+/* parse and execute rather than of the commands.                   */
+/*------------------------------------------------------------------*/
+void bchain(void)
+{
+    char *script = "bench_chain.txt";
+    char *none[] = { NULL };
+    char cmd[CHAINLEN*10];
+    struct result r;
+    int i;
+
+    for (cmd[0]='\0',i=0;i<CHAINLEN-1;i++)
+        strcat(cmd,"true && ");
+    strcat(cmd,"true");
+    mkscript(script,cmd);
+    run(none,script,&r);
+    report("chain (&&)",&r);
+    latency(none,cmd);
+
+    for (cmd[0]='\0',i=0;i<CHAINLEN-1;i++)
+        strcat(cmd,"false || ");
+    strcat(cmd,"true");
+    mkscript(script,cmd);
+    run(none,script,&r);
+    report("chain (||)",&r);
+    latency(none,cmd);
+    unlink(script);
+}
+
+/*------------------------------------------------------------------*/
+/* PATH miss benchmark: every line runs a command that isn't in any */
+/* PATH directory, so each one searches all of them (misses aren't  */
+/* remembered by the command hash table) and fails.                 */
+/*------------------------------------------------------------------*/
+void bpathmiss(void)
+{
+    char *script = "bench_pathmiss.txt";
+    char *none[] = { NULL };
+    struct result r;
+
+    mkscript(script,"no-such-command-here");
+    run(none,script,&r);
+    report("pathmiss",&r);
+    latency(none,"no-such-command-here");
+    unlink(script);
+}
+
+/*------------------------------------------------------------------*/
+/* Glob benchmark: every line expands a pattern in a directory with */
+/* NGLOBFILES files. Only the first line reads the directory; the   */
+/* rest use prog1's directory cache, so the time is mostly that of  */
+/* matching the cached names. Runs nlines/100 lines.                */
+/*------------------------------------------------------------------*/
+#define NGLOBFILES 20000
+
+void bglob(void)
+{
+    char *script = "bench_glob.txt";
+    char *dir = "bench_glob";
+    char *none[] = { NULL };
+    char name[64];
+    struct result r;
+    int i, fd, n;
+
+    mkdir(dir,0755);
+    for (i=0;i<NGLOBFILES;i++) {
+        sprintf(name,"%s/f%d", dir, i);
+        fd = open(name,O_WRONLY|O_CREAT,0644);
+        if (fd == -1) {
+            perror(name);
+            exit(1);
+        }
+        close(fd);
+    }
+    n = nlines;
+    nlines = n / 100 > 0 ? n / 100 : 1;
+    mkscript(script,"echo bench_glob/f1999*");
+    run(none,script,&r);
+    report("glob (20000 names)",&r);
+    latency(none,"echo bench_glob/f1999*");
+    nlines = n;
+    unlink(script);
+    for (i=0;i<NGLOBFILES;i++) {
+        sprintf(name,"%s/f%d", dir, i);
+        unlink(name);
+    }
+    rmdir(dir);
+}
+
+int main(int argc, char *argv[])
+{
+    /*-----------------*/
+    /* Handle options. */
+    /*-----------------*/
+    while (argc > 1 && argv[1][0] == '-') {
+        if (!strcmp(argv[1],"-p") && argc > 2) {
+            prog1 = argv[2];
+            argc -= 2;
+            argv += 2;
+            continue;
+        }
+        if (!strcmp(argv[1],"-l") && argc > 2) {
+            nlines = atoi(argv[2]);
+            argc -= 2;
+            argv += 2;
+            continue;
+        }
+        fprintf(stderr,"Unknown option %s\n", argv[1]);
+        exit(1);
+    }
+    if (argc < 2 || nlines < 1) {
+        fprintf(stderr,"Usage: prog1_bench [-p prog1path] [-l nlines] "
+                "benchmark...\n");
+        exit(1);
+    }
+
+    for (;argc>1;argc--,argv++) {
+        if (!strcmp(argv[1],"getline"))
+            bgetline();
+        else if (!strcmp(argv[1],"spawn"))
+            bspawn();
+        else if (!strcmp(argv[1],"builtin"))
+            bbuiltin();
+        else if (!strcmp(argv[1],"chain"))
+            bchain();
+        else if (!strcmp(argv[1],"pathmiss"))
+            bpathmiss();
+        else if (!strcmp(argv[1],"glob"))
+            bglob();
+        else if (!strcmp(argv[1],"all")) {
+            bgetline();
+            bbuiltin();
+            bchain();
+            bpathmiss();
+            bspawn();
+            bglob();
+        } else {
+            fprintf(stderr,"Unknown benchmark %s\n", argv[1]);
+            exit(1);
+        }
+    }
+    return 0;
+}
@@ -3,46 +3,389 @@
 /* Stanley Wileman                                               */
 /* Last change: 8/29/2016                                        */
 /*                                                               */
-/* Process command lines (100 char max) with at most 16 "words"  */
-/* and one command. No wildcard or shell variable processing.    */
-/* A word on the command line contains at most MAXWORDLEN chars. */
-/* Words are expected to contain only printable characters.      */
+/* Process command lines of any length, with any number of       */
+/* "words". Words are expected to contain only printable         */
+/* characters.                                                   */
 /* Words are separated by spaces and/or tab characters.          */
 /*                                                               */
-/* No pipes, conditional or sequential command handling is done. */
-/* No redirection of file descriptors is provided.               */
-/* No "wildcard" characters (e.g. * and ?) are processed.        */
-/* No shell variables are recognized.                            */
+/* Pipelines (|), and conditional (&& and ||) and sequential (;) */
+/* commands are handled, as are redirections of the standard     */
+/* input, output and error (<, >, >>, 2>&1 and << here-docs),    */
+/* command substitution, $(...), and shell variables (NAME=value,*/
+/* $NAME, export and unset), and "wildcard" characters (*, ? and */
+/* [...]) in command arguments.                                  */
 /*                                                               */
 /* This file is provided to students in CSCI 4500 for their use  */
 /* in developing solutions to the first programming assignment.  */
 /*---------------------------------------------------------------*/
+/* Usage:    prog1 [-n] [-u] [-e fork|spawn|server] [-R]         */
+/*                 [-j N [-o]] [-s statsfile] [-S socket]        */
+/*                                                               */
+/*   -n   read and analyze command lines, but don't execute them */
+/*   -u   unbuffered input: read and echo one character per      */
+/*        system call (as the shell originally did)              */
+/*   -e   how child processes are created: fork + execve (the    */
+/*        default), posix_spawn, or a fork server process        */
+/*   -R   relay data between pipeline stages through the shell   */
+/*        (with splice) instead of connecting them directly      */
+/*   -j   execute up to N command lines at the same time         */
+/*   -o   with -j, keep each line's output together, in order    */
+/*   -s   write each command's times to statsfile (CSV), and     */
+/*        display a summary with the slowest commands at the end */
+/*   -S   read command lines from clients connecting to a Unix   */
+/*        domain socket, instead of from the standard input      */
+/*---------------------------------------------------------------*/
+#define _GNU_SOURCE           /* for pipe2 and splice */
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
 #include <stdlib.h>
 #include <signal.h>
+#include <time.h>
+#include <spawn.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/syscall.h>
+#include <sched.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <fnmatch.h>
 
-#define MAXLINELEN 100        /* max chars in an input line */
-#define NWORDS 16         /* max words on command line */
-#define MAXWORDLEN 64         /* maximum word length */
+#define LINESIZE 128          /* initial size of the line buffer */
+#define NWORDS 16         /* initial size of the words array */
+#define PATHSIZE 256          /* initial size of the path buffer */
+#define CMDLEN 256            /* max chars of a command kept for display */
+#define IBUFSIZE 8192         /* size of the input buffer */
+#define EBUFSIZE 512          /* initial size of the echo buffer */
+#define NHASH 64          /* # of buckets in the command hash table */
+#define RELAYSIZE 65536       /* max bytes moved by one splice */
+#define NJOBS 256         /* max # of background jobs */
+#define PQSIZE 1024           /* max # of unfinished lines with -j */
+#define NSLOW 10          /* # of slowest commands in the summary */
+#define ACHUNK 4096           /* size of an arena's first chunk */
+#define MAXDEPTH 64           /* max nesting of source commands */
+#define SUBSTMAX (16<<20)     /* max bytes of output captured by $(...) */
+#define NDHASH 64         /* # of buckets in the directory cache */
+#define NDIRS 256         /* max # of directories in the cache */
+#define NCLIENTS 64           /* max # of clients connected with -S */
+#define CBUFSIZE 4096         /* initial size of a client's input buffer */
 
 extern char **environ;        /* environment */
 
-char line[MAXLINELEN+1];      /* input line */
-char *words[NWORDS];              /* ptrs to words from the command line */
+char *line;           /* input line (in linearena) */
+char **words;             /* ptrs to words from the command line */
 int nwds;             /* # of words in the command line */
-char path[MAXWORDLEN];        /* path to the command */
-char *argv[NWORDS+1];         /* argv structure for execve */
+char *path;           /* path to the command */
+size_t pathsize;          /* # of chars allocated for path */
+
+int noexec;           /* non-zero if the -n option was specified */
+int unbuffered;           /* non-zero if the -u option was specified */
+int isterm;           /* non-zero if input is from a terminal */
+int subshell;         /* non-zero in a line process or forked builtin */
+
+#define E_FORK 0          /* engine: fork, then execve in the child */
+#define E_SPAWN 1         /* engine: posix_spawn */
+#define E_SERVER 2        /* engine: ask the fork server */
+int engine = E_FORK;          /* how child processes are created (-e) */
+int server = -1;          /* socket to the fork server, or -1 */
+int cwdfd = -1;           /* current directory (for the fork server) */
+int relaymode;            /* non-zero if the -R option was specified */
+
+/*------------------------------------------------------------------*/
+/* When the standard input is a seekable file (and not a terminal), */
+/* it is read in blocks of IBUFSIZE bytes into 'ibuf'. Characters   */
+/* that have been read from the file but not yet used by Getline    */
+/* are ibuf[ibufpos] ... ibuf[ibuflen-1]. Before a child process is */
+/* created, syncinput moves the file offset back over those bytes,  */
+/* so the child sees the input exactly where the shell stopped.     */
+/* When the input can't be buffered (a pipe, for example), ibuffered */
+/* is 0 and one character is read at a time, as before.             */
+/*------------------------------------------------------------------*/
+char ibuf[IBUFSIZE];          /* input buffer */
+int ibufpos;          /* index of next unused char in ibuf */
+int ibuflen;          /* # of chars in ibuf */
+int ibuffered;            /* non-zero if input is block buffered */
+
+char *ebuf;           /* echoed input not yet written */
+int ebuflen;          /* # of chars in ebuf */
+int ebufsize;         /* # of chars allocated for ebuf */
+int holdecho;         /* non-zero to leave the echoed line in ebuf */
+
+/*------------------------------------------------------------------*/
+/* With -S, command lines come from the clients connected to the    */
+/* shell's socket. Each client's input is kept in its own buffer,   */
+/* and while a line (and its here-documents) is taken from client   */
+/* cl, curclient is cl, and getch reads from that buffer instead    */
+/* of the standard input.                                           */
+/*------------------------------------------------------------------*/
+struct client {
+    int fd;             /* connection, or -1 if the slot is free */
+    char *buf;          /* input received from the client */
+    size_t pos;         /* index of the next unused char in buf */
+    size_t len;         /* # of chars in buf */
+    size_t size;        /* # of chars allocated for buf */
+    int eof;            /* non-zero after end of file (or an error) */
+    int out;            /* memory file with the reply, or -1 if none */
+    off_t outpos;       /* # of bytes of out sent */
+    off_t outlen;       /* # of bytes in out */
+    char hdr[64];       /* the reply's first line */
+    int hdrpos;         /* # of chars of hdr sent */
+    int hdrlen;         /* # of chars in hdr */
+} clients[NCLIENTS];
+
+struct client *curclient;   /* client being read, or NULL */
+int clientquit;         /* non-zero when "exit" is run for a client */
+
+/*-------------------------------------------------------------------*/
+/* Read more input from client cl into its buffer (discarding the    */
+/* chars already used, and making the buffer larger if it's full).   */
+/* Return the result of read: > 0 on success, 0 at end of file, or   */
+/* -1 on error.                                                      */
+/*-------------------------------------------------------------------*/
+ssize_t clientfill(struct client *cl)
+{
+    char *p;
+    ssize_t n;
+
+    if (cl->pos > 0) {
+        memmove(cl->buf,cl->buf+cl->pos,cl->len-cl->pos);
+        cl->len -= cl->pos;
+        cl->pos = 0;
+    }
+    if (cl->len == cl->size) {
+        p = realloc(cl->buf,cl->size > 0 ? 2 * cl->size : CBUFSIZE);
+        if (p == NULL)
+            return -1;
+        cl->buf = p;
+        cl->size = cl->size > 0 ? 2 * cl->size : CBUFSIZE;
+    }
+    n = read(cl->fd,cl->buf+cl->len,cl->size-cl->len);
+    if (n > 0)
+        cl->len += n;
+    return n;
+}
+
+/*------------------------------------------------------------------*/
+/* An arena is a simple way to allocate many small pieces of memory */
+/* that are all freed together. Memory comes from a list of chunks: */
+/* each allocation just takes the next bytes of the current chunk,  */
+/* and a new chunk (twice as large) is added when that runs out.    */
+/* Resetting an arena makes all of its memory available again in    */
+/* constant time, without freeing the chunks.                       */
+/*------------------------------------------------------------------*/
+struct chunk {
+    struct chunk *next;     /* next chunk in the arena */
+    size_t size;        /* # of bytes in data */
+    size_t used;        /* # of bytes of data allocated */
+    char data[];        /* the memory */
+};
+
+struct arena {
+    struct chunk *first;    /* first chunk (NULL if none yet) */
+    struct chunk *cur;      /* chunk being allocated from */
+};
+
+/*----------------------------------------------------------------*/
+/* Allocate n bytes (aligned for any type) from arena a. If there */
+/* isn't enough memory, display a message and end the shell.      */
+/*----------------------------------------------------------------*/
+void *aalloc(struct arena *a, size_t n)
+{
+    struct chunk *c, *last;
+    size_t size;
+    void *p;
+
+    n = (n + 15) & ~(size_t)15;
+    last = NULL;
+    c = a->cur;
+    while (c != NULL && c->used + n > c->size) {
+        last = c;           /* doesn't fit; try the next chunk */
+        c = c->next;
+        if (c != NULL)
+            c->used = 0;
+    }
+    if (c == NULL) {
+        size = last != NULL ? 2 * last->size : ACHUNK;
+        while (size < n)
+            size *= 2;
+        c = malloc(sizeof(struct chunk) + size);
+        if (c == NULL) {
+            write(2,"*** ERROR: Out of memory.\n",26);
+            exit(1);
+        }
+        c->next = NULL;
+        c->size = size;
+        c->used = 0;
+        if (last == NULL)
+            a->first = c;
+        else
+            last->next = c;
+    }
+    a->cur = c;
+    p = c->data + c->used;
+    c->used += n;
+    return p;
+}
+
+/*----------------------------------------------------*/
+/* Make all the memory in arena a available again.    */
+/*----------------------------------------------------*/
+void areset(struct arena *a)
+{
+    a->cur = a->first;
+    if (a->first != NULL)
+        a->first->used = 0;
+}
+
+/*------------------------------------------------------------------*/
+/* Make the n bytes at p, the last memory allocated from arena a, m */
+/* bytes long (m > n). Return a pointer to the memory, which keeps  */
+/* its contents but may have moved. When the current chunk has room */
+/* the memory simply grows in place; otherwise it's copied.         */
+/*------------------------------------------------------------------*/
+void *agrow(struct arena *a, void *p, size_t n, size_t m)
+{
+    struct chunk *c;
+    void *q;
+
+    n = (n + 15) & ~(size_t)15;
+    m = (m + 15) & ~(size_t)15;
+    c = a->cur;
+    if (c != NULL && (char *)p + n == c->data + c->used
+            && c->used - n + m <= c->size) {
+        c->used += m - n;
+        return p;
+    }
+    q = aalloc(a,m);
+    memcpy(q,p,n);
+    return q;
+}
+
+/*------------------------------------------------------------------*/
+/* A mark records how much of an arena is in use, so the memory     */
+/* allocated after it can be released (in constant time) without   */
+/* releasing what was allocated before it.                          */
+/*------------------------------------------------------------------*/
+struct amark {
+    struct chunk *cur;      /* chunk being allocated from */
+    size_t used;        /* # of bytes of it allocated */
+};
+
+void amark(struct arena *a, struct amark *m)
+{
+    m->cur = a->cur;
+    m->used = a->cur != NULL ? a->cur->used : 0;
+}
+
+void arelease(struct arena *a, struct amark *m)
+{
+    if (m->cur == NULL) {
+        areset(a);
+        return;
+    }
+    a->cur = m->cur;
+    a->cur->used = m->used;
+}
+
+struct arena linearena;     /* the current command line and its tree */
+struct arena xarena;        /* words expanded for running commands */
+
+/*-------------------------------------------------------------*/
+/* Get one input character in *c. Return the result of read(): */
+/* 1 on success, 0 at end of file, or -1 on error.             */
+/*-------------------------------------------------------------*/
+int getch(char *c)
+{
+    int n;
+
+    if (curclient != NULL) {        /* from a client (-S) */
+        if (curclient->pos == curclient->len) {
+            n = clientfill(curclient);
+            if (n <= 0)
+                return 0;       /* an error is end of file too */
+        }
+        *c = curclient->buf[curclient->pos++];
+        return 1;
+    }
+
+    if (!ibuffered)
+        return read(0,c,1);     /* one character at a time */
+
+    if (ibufpos == ibuflen) {       /* buffer empty? */
+        n = read(0,ibuf,IBUFSIZE);  /* yes, so refill it */
+        if (n <= 0)
+            return n;
+        ibuflen = n;
+        ibufpos = 0;
+    }
+    *c = ibuf[ibufpos++];
+    return 1;
+}
+
+/*----------------------------------------------------------------*/
+/* Reposition file descriptor 0 to the first character not yet    */
+/* used by Getline, and discard the buffered input. This must be   */
+/* done before a child process is created, as the child shares the */
+/* file offset with the shell and may read the standard input.     */
+/*----------------------------------------------------------------*/
+void syncinput(void)
+{
+    if (ibufpos < ibuflen)
+        lseek(0,(off_t)(ibufpos - ibuflen),SEEK_CUR);
+    ibufpos = ibuflen = 0;
+}
+
+/*---------------------------------------------*/
+/* Write the echoed input that's been buffered. */
+/*---------------------------------------------*/
+void flushecho(void)
+{
+    if (ebuflen > 0)
+        write(1,ebuf,ebuflen);
+    ebuflen = 0;
+}
+
+/*------------------------------------------------------------*/
+/* Add character c to the echo buffer. When the buffer is full */
+/* it is written, unless the whole line must be held (then the */
+/* buffer is made larger).                                     */
+/*------------------------------------------------------------*/
+void echo(char c)
+{
+    if (unbuffered) {
+        write(1,&c,1);
+        return;
+    }
+    if (ebuflen == ebufsize) {
+        if (ebufsize > 0 && !holdecho)
+            flushecho();
+        else {
+            ebufsize = ebufsize > 0 ? 2 * ebufsize : EBUFSIZE;
+            ebuf = realloc(ebuf,ebufsize);
+            if (ebuf == NULL) {
+                write(2,"*** ERROR: Out of memory.\n",26);
+                exit(1);
+            }
+        }
+    }
+    ebuf[ebuflen++] = c;
+}
 
 /*------------------------------------------------------------------*/
-/* Get a line from the standard input. Return 1 on success, or 0 at */
-/* end of file. If the line contains only whitespace, ignore it and */
-/* get another line. If the line is too long, display a message and */
-/* get another line. If read fails, diagnose the error and abort.   */
+/* Get a line from the standard input into 'line', which is         */
+/* allocated from linearena and grows as needed, so a line may be   */
+/* any length. Return 1 on success, or 0 at end of file. If the     */
+/* line contains only whitespace, ignore it and get another line.   */
+/* If read fails, diagnose the error and abort.                     */
 /*------------------------------------------------------------------*/
 /* This function will display a prompt ("# ") if the input comes    */
 /* from a terminal. Otherwise no prompt is displayed, but the       */
@@ -50,47 +393,52 @@ char *argv[NWORDS+1];         /* argv structure for execve */
 /* terminal, the input is automatically echoed (assuming we're in   */
 /* "cooked" mode).                                                  */
 /*------------------------------------------------------------------*/
-/* Students: Make certain you understand the reason the input is    */
-/* read one character at a time. It could be read in larger pieces  */
-/* but then additional code would be required to guarantee only one */
-/* line of input is processed when the standard input (that is,     */
-/* file descriptor 1) is redirected to a file.                      */
+/* Students: Make certain you understand the reason the input was   */
+/* originally read one character at a time. It is now read in       */
+/* larger pieces when possible (see getch), and syncinput is used   */
+/* to guarantee only one line of input is processed by the shell    */
+/* when the standard input (that is, file descriptor 0) is          */
+/* redirected to a file. The echoed input is also written a line at */
+/* a time instead of a character at a time.                         */
 /*------------------------------------------------------------------*/
 int Getline(void)
 {
     int n;      /* result of read system call */
     int len;        /* length of input line */
+    size_t size;    /* # of chars allocated for line */
     int gotnb;      /* non-zero when non-whitespace was seen */
     char c;     /* current input character */
-    char *msg;      /* error message */
-    int isterm;     /* non-zero if input is from a terminal */
 
-    isterm = isatty(0);     /* see if file descriptor 0 is a terminal */
+    size = LINESIZE;
+    line = aalloc(&linearena,size);
     for(;;) {
         if (isterm)
             write(1,"# ",2);
         gotnb = len = 0;
         for(;;) {
 
-            n = read(0,&c,1);       /* read one character */
+            n = getch(&c);      /* get one character */
 
-            if (n == 0)         /* end of file? */
+            if (n == 0) {       /* end of file? */
+                flushecho();
                 return 0;       /* yes, so return 0 */
+            }
 
             if (n == -1) {      /* error reading? */
+                flushecho();
                 perror("Error reading command line");
                 exit(1);
             }
 
-            if (!isterm)        /* if input not from a terminal */
-                write (1,&c,1);     /* echo the character */
+            if (!isterm && curclient == NULL)   /* if input not from a */
+                echo(c);        /* terminal, echo the character */
 
             if (c == '\n')      /* end of line? */
                 break;
 
-            if (len >= MAXLINELEN) {    /* too many chars? */
-                len++;          /* yes, so just update the length */
-                continue;
+            if ((size_t)len + 1 == size) {  /* no room for c and the null? */
+                line = agrow(&linearena,line,size,2*size);
+                size *= 2;
             }
 
             if (c != ' ' && c != '\t')  /* was input not whitespace? */
@@ -98,13 +446,9 @@ int Getline(void)
 
             line[len++] = c;        /* save the input character */
         }
+        if (!holdecho)
+            flushecho();        /* write the echoed line */
 
-        if (len >= MAXLINELEN) {    /* if the input line was too long... */
-            char *msg;
-            msg = "Input line is too long.\n";
-            write(2,msg,strlen(msg));
-            continue;
-        }
         if (gotnb == 0)         /* line contains only whitespace */
             continue;
 
@@ -113,78 +457,629 @@ int Getline(void)
     }
 }
 
+/*------------------------------------------------------------------*/
+/* Return the next word in the string at *sp (or NULL if there are  */
+/* no more), terminating it with a null byte, and advance *sp past  */
+/* it. Words are separated by spaces and tabs, but a command        */
+/* substitution "$(...)" (which may contain spaces, and be nested)  */
+/* is part of the word it's in. Set *open if a "$(" isn't closed.   */
+/*------------------------------------------------------------------*/
+char *nextword(char **sp, int *open)
+{
+    char *p, *w;
+    int depth;          /* # of unclosed parentheses */
+
+    for (p=*sp;*p==' ' || *p=='\t';p++)
+        ;
+    if (*p == '\0') {
+        *sp = p;
+        return NULL;
+    }
+    w = p;
+    depth = 0;
+    for (;*p!='\0';p++) {
+        if (depth == 0 && (*p == ' ' || *p == '\t'))
+            break;
+        if (*p == '$' && p[1] == '(') {
+            depth++;
+            p++;
+        } else if (*p == '(' && depth > 0)
+            depth++;
+        else if (*p == ')' && depth > 0)
+            depth--;
+    }
+    if (depth > 0)
+        *open = 1;
+    if (*p != '\0')
+        *p++ = '\0';
+    *sp = p;
+    return w;
+}
+
 /*------------------------------------------------*/
 /* Identify "words" and sequencing operators on   */
-/* a command line (in the global array 'line').   */
+/* a command line (the string s, usually 'line'). */
 /* Put a pointer to each null-terminated string   */
 /* with a word or sequencing operator (that is,   */
 /* ";" or "||" or "&&") in the 'words' array, and */
 /* store the number of such items in 'nwds'.      */
 /*                                                */
-/* On success, return 1.                          */
-/* If there are too many words, or a word is too  */
-/* long, diagnose the error (by writing a message */
-/* to the standard error device, file descriptor  */
-/* 2) and return 0.                               */
+/* The words array is allocated from arena a, and */
+/* grows as needed, so there may be any number of */
+/* words, of any length. Return the number of     */
+/* words (0 if there are none).                   */
 /*                                                */
-/* Note that except for space and tab characters, */
-/* No characters are explicitly tested in this    */
-/* function. We expect that the 'line' variable   */
-/* does NOT include an end of line character, but */
-/* that it is terminated by a null byte ('\0').   */
+/* Words are separated by spaces and tabs, except */
+/* that a command substitution "$(...)" is kept    */
+/* whole (see 'nextword'). If a "$(" isn't closed, */
+/* diagnose the error and return 0. We expect that */
+/* the string s does NOT include an end of line   */
+/* character, but that it is terminated by a null */
+/* byte ('\0').                                   */
 /*------------------------------------------------*/
-int lex(void)
+int lex(struct arena *a, char *s)
 {
     char *p;            /* pointer to current word */
-    char *msg;          /* error message */
+    int size;           /* # of entries allocated for words */
+    int open;           /* non-zero if a "$(" isn't closed */
 
     nwds = 0;
-    p = strtok(line," \t"); /* get pointer to a word, if any exists */
+    open = 0;
+    size = NWORDS;
+    words = aalloc(a,size*sizeof(char *));
+    p = nextword(&s,&open); /* get pointer to a word, if any exists */
     while (p != NULL) {
-        if (nwds == NWORDS) {
-            msg = "*** ERROR: Too many words.\n";
-            write(2,msg,strlen(msg));
-            return 0;       /* return error indication */
-        }
-        if (strlen(p) >= MAXWORDLEN) {
-            msg = "*** ERROR: Word too long.\n";
-            write(2,msg,strlen(msg));
-            return 0;       /* return error indication */
+        if (nwds == size) {     /* words is full, so enlarge it */
+            words = agrow(a,words,size*sizeof(char *),
+                          2*size*sizeof(char *));
+            size *= 2;
         }
         words[nwds] = p;    /* save pointer to the word */
         nwds++;         /* increase the word count */
-        p = strtok(NULL," \t"); /* get pointer to next word, if any */
+        p = nextword(&s,&open); /* get pointer to next word, if any */
+    }
+    if (open) {
+        write(2,"*** ERROR: Missing ')'.\n",24);
+        return 0;
+    }
+    return nwds;
+}
+
+/*------------------------------------------------------------------*/
+/* A command line is parsed into a tree of nodes. The leaves are    */
+/* commands (N_CMD), which are grouped into pipelines (N_PIPE). The */
+/* pipelines on a line are joined by the sequencing operators; for  */
+/* "p1 op1 p2 op2 p3" the tree is op1(p1, op2(p2, p3)). Each        */
+/* operator node's left side is a pipeline, and its right side is   */
+/* the rest of the line (or NULL). When a && or || operator stops   */
+/* execution, none of the rest of the line is executed.             */
+/*------------------------------------------------------------------*/
+#define N_CMD 0           /* a command and its arguments */
+#define N_PIPE 1          /* a pipeline of one or more commands */
+#define N_SEQ 2           /* left ; right */
+#define N_BG 3            /* left & right */
+#define N_AND 4           /* left && right */
+#define N_OR 5            /* left || right */
+
+/*------------------------------------------------------------------*/
+/* A command's redirections are kept in a list, in the order they   */
+/* appear, since each may depend on those before it ("> f 2>&1").   */
+/* Only the standard input, output and error (0, 1, 2) may be       */
+/* redirected. The text of a here-document ("<< TAG") is read from  */
+/* the input lines after the command, up to a line that is just TAG. */
+/*------------------------------------------------------------------*/
+#define R_IN 0            /* n< file */
+#define R_OUT 1           /* n> file */
+#define R_APPEND 2        /* n>> file */
+#define R_DUP 3           /* n>&m */
+#define R_HEREDOC 4       /* n<< TAG */
+
+struct redir {
+    struct redir *next;     /* next redirection for the command */
+    struct redir *nextdoc;  /* next here-document on the line */
+    int type;           /* R_IN ... R_HEREDOC */
+    int fd;         /* descriptor redirected */
+    int from;           /* for R_DUP, the descriptor copied */
+    char *word;         /* file name, or here-document's TAG */
+    char *text;         /* text of a here-document */
+    size_t len;         /* # of chars in text */
+};
+
+struct redir *heredocs;     /* here-documents of the line just parsed */
+struct redir **lastdoc;     /* where to link the next here-document */
+
+struct node {
+    int type;           /* N_CMD ... N_OR */
+    union {
+        struct {            /* N_CMD */
+            int argc;           /* # of arguments */
+            char **argv;        /* arguments, NULL terminated */
+            struct builtin *b;  /* builtin, or NULL if a program */
+            struct redir *redir;    /* redirections, or NULL */
+            int nredir;         /* # of redirections */
+            char **assign;      /* NAME=value words before the command */
+            int nassign;        /* # of them */
+        } cmd;
+        struct {            /* N_PIPE */
+            int ns;         /* # of commands */
+            int timed;      /* non-zero if prefixed by "time" */
+            int dollar;     /* non-zero if a word has a "$" */
+            int wild;       /* non-zero if an argument has *, ? or [ */
+            struct node **stage;    /* the commands */
+        } pipe;
+        struct {            /* N_SEQ, N_BG, N_AND, N_OR */
+            struct node *left;  /* a pipeline */
+            struct node *right; /* rest of the line, or NULL */
+        } op;
+    } u;
+};
+
+/*------------------------------------------------------------------*/
+/* Read the text of here-document r from the standard input: the    */
+/* lines up to (but not including) a line that is just r's TAG, or  */
+/* up to the end of file. The text is allocated from linearena. The */
+/* lines are echoed, or prompted for with "> " on a terminal.       */
+/*------------------------------------------------------------------*/
+void hereinput(struct redir *r)
+{
+    size_t size, len, start, taglen;
+    int n;
+    char c;
+
+    taglen = strlen(r->word);
+    size = LINESIZE;
+    len = 0;
+    r->text = aalloc(&linearena,size);
+    for (;;) {
+        if (isterm)
+            write(1,"> ",2);
+        start = len;
+        do {
+            n = getch(&c);
+            if (n == -1) {
+                flushecho();
+                perror("Error reading here-document");
+                exit(1);
+            }
+            if (n == 0)         /* end of file ends it too */
+                break;
+            if (!isterm && curclient == NULL)
+                echo(c);
+            if (len == size) {
+                r->text = agrow(&linearena,r->text,size,2*size);
+                size *= 2;
+            }
+            r->text[len++] = c;
+        } while (c != '\n');
+        if (n == 0)
+            break;
+        if (len - start == taglen + 1
+                && !memcmp(r->text+start,r->word,taglen)) {
+            len = start;        /* the TAG line isn't part of it */
+            break;
+        }
+    }
+    r->len = len;
+    if (!holdecho)
+        flushecho();
+}
+
+/*------------------------------------------------------------------*/
+/* Shell variables are kept in a hash table with open addressing    */
+/* (linear probing): a name with hash value h is looked for in      */
+/* vars[h], then vars[h+1], and so on, up to an empty slot. Unset   */
+/* leaves a "deleted" slot, so names further along the same run of  */
+/* slots are still found. The table is doubled (and the deleted     */
+/* slots dropped) when more than half of it is in use.              */
+/*                                                                  */
+/* Each variable is stored as a "NAME=value" string, the form used  */
+/* in the environment. The environment given to programs (envp) is  */
+/* made from the exported variables only when an exported variable  */
+/* has changed since it was last made; otherwise the same array is  */
+/* used again, so most commands cost nothing here.                  */
+/*------------------------------------------------------------------*/
+struct var {
+    char *str;          /* "NAME=value", or NULL if empty/deleted */
+    size_t nlen;        /* length of NAME */
+    int exported;       /* non-zero if in the environment */
+    int deleted;        /* non-zero if the slot was freed by unset */
+};
+
+struct var *vars;       /* the table */
+size_t nvars;           /* # of slots (a power of 2) */
+size_t nvused;          /* # of slots used or deleted */
+char **envp;            /* environment for programs */
+int envdirty = 1;       /* non-zero if envp must be made again */
+int laststatus;         /* exit status of the last pipeline ($?) */
+
+/*------------------------------------------------------------------*/
+/* Return the hash value of the n chars of name.                    */
+/*------------------------------------------------------------------*/
+size_t varhash(char *name, size_t n)
+{
+    size_t h, i;
+
+    for (h=0,i=0;i<n;i++)
+        h = h * 31 + (unsigned char)name[i];
+    return h;
+}
+
+/*------------------------------------------------------------------*/
+/* Return the slot for the variable whose name is the n chars at    */
+/* name. If it isn't set, return the empty slot where it would go   */
+/* (its str is NULL), reusing a deleted slot if one was passed.     */
+/*------------------------------------------------------------------*/
+struct var *findvar(char *name, size_t n)
+{
+    struct var *v, *free;
+    size_t h;
+
+    free = NULL;
+    for (h=varhash(name,n)&(nvars-1);;h=(h+1)&(nvars-1)) {
+        v = &vars[h];
+        if (v->str == NULL) {
+            if (!v->deleted)
+                return free != NULL ? free : v;
+            if (free == NULL)
+                free = v;
+        } else if (v->nlen == n && !memcmp(v->str,name,n))
+            return v;
+    }
+}
+
+/*------------------------------------------------------------------*/
+/* Make the table twice as large, or (if it's empty) create it.     */
+/*------------------------------------------------------------------*/
+void growvars(void)
+{
+    struct var *old, *v;
+    size_t n, i;
+
+    old = vars;
+    n = nvars;
+    nvars = n > 0 ? 2 * n : 64;
+    vars = calloc(nvars,sizeof(struct var));
+    if (vars == NULL) {
+        write(2,"*** ERROR: Out of memory.\n",26);
+        exit(1);
+    }
+    nvused = 0;
+    for (i=0;i<n;i++)
+        if (old[i].str != NULL) {
+            v = findvar(old[i].str,old[i].nlen);
+            *v = old[i];
+            nvused++;
+        }
+    free(old);
+}
+
+/*------------------------------------------------------------------*/
+/* Return the value of the variable name, or NULL if it isn't set.  */
+/*------------------------------------------------------------------*/
+char *getvar(char *name)
+{
+    struct var *v;
+    size_t n;
+
+    n = strlen(name);
+    v = findvar(name,n);
+    return v->str != NULL ? v->str + n + 1 : NULL;
+}
+
+/*------------------------------------------------------------------*/
+/* Set a variable from the string s, which is "NAME=value". If      */
+/* export is non-zero, the variable is also exported; otherwise it  */
+/* stays exported if it was.                                        */
+/*------------------------------------------------------------------*/
+void setvar(char *s, int export)
+{
+    struct var *v;
+    size_t n;
+    char *str;
+
+    if ((nvused + 1) * 2 > nvars)
+        growvars();
+    n = strchr(s,'=') - s;
+    str = strdup(s);
+    if (str == NULL) {
+        write(2,"*** ERROR: Out of memory.\n",26);
+        exit(1);
+    }
+    v = findvar(s,n);
+    if (v->str == NULL) {       /* a new variable */
+        if (!v->deleted)
+            nvused++;
+        v->exported = 0;
+        v->deleted = 0;
+        v->nlen = n;
+    }
+    free(v->str);
+    v->str = str;
+    v->exported |= export;
+    if (v->exported)
+        envdirty = 1;
+}
+
+/*------------------------------------------------------------------*/
+/* Unset the variable name, if it's set.                            */
+/*------------------------------------------------------------------*/
+void unsetvar(char *name)
+{
+    struct var *v;
+
+    v = findvar(name,strlen(name));
+    if (v->str == NULL)
+        return;
+    if (v->exported)
+        envdirty = 1;
+    free(v->str);
+    v->str = NULL;
+    v->deleted = 1;
+}
+
+/*------------------------------------------------------------------*/
+/* Return the environment for programs: the exported variables. The */
+/* array is only made again if an exported variable has changed.    */
+/*------------------------------------------------------------------*/
+char **getenvp(void)
+{
+    size_t i, n;
+
+    if (!envdirty)
+        return envp;
+    for (n=0,i=0;i<nvars;i++)
+        if (vars[i].str != NULL && vars[i].exported)
+            n++;
+    free(envp);
+    envp = malloc((n+1)*sizeof(char *));
+    if (envp == NULL) {
+        write(2,"*** ERROR: Out of memory.\n",26);
+        exit(1);
+    }
+    for (n=0,i=0;i<nvars;i++)
+        if (vars[i].str != NULL && vars[i].exported)
+            envp[n++] = vars[i].str;
+    envp[n] = NULL;
+    envdirty = 0;
+    return envp;
+}
+
+/*------------------------------------------------------------------*/
+/* Return the length of the variable name at the start of w, or 0   */
+/* if there isn't one. A name is a letter or underscore followed by */
+/* letters, digits and underscores.                                 */
+/*------------------------------------------------------------------*/
+int namelen(char *w)
+{
+    char *p;
+
+    if (!(isalpha((unsigned char)*w) || *w == '_'))
+        return 0;
+    for (p=w+1;isalnum((unsigned char)*p) || *p == '_';p++)
+        ;
+    return p - w;
+}
+
+/*----------------------------------------------------------*/
+/* Return non-zero if the word w is an assignment, NAME=value. */
+/*----------------------------------------------------------*/
+int isassign(char *w)
+{
+    int n;
+
+    n = namelen(w);
+    return n > 0 && w[n] == '=';
+}
+
+/*------------------------------------------------------------------*/
+/* Put every variable in the shell's environment in the table.      */
+/*------------------------------------------------------------------*/
+void initvars(void)
+{
+    char **e;
+
+    growvars();
+    for (e=environ;*e!=NULL;e++)
+        if (strchr(*e,'=') != NULL)
+            setvar(*e,1);
+}
+
+/*------------------------------------------------------------------*/
+/* The command hash table remembers where each command found by a   */
+/* PATH search lives, so later uses of the same command don't have  */
+/* to search the PATH directories again. Each entry records the     */
+/* modification time of the directory in which the command was      */
+/* found; if that directory has since changed (a file was added,    */
+/* removed or renamed), the entry is discarded. The whole table is  */
+/* discarded if the value of PATH is not the value used to fill it, */
+/* or by the "hash -r" command.                                     */
+/*------------------------------------------------------------------*/
+struct hashent {
+    struct hashent *next;   /* next entry in the same bucket */
+    char *name;         /* command name (e.g. "ls") */
+    char *path;         /* path to the command (e.g. "/bin/ls") */
+    int dlen;           /* length of the directory part of path */
+    struct timespec mtime;  /* modification time of the directory */
+    int hits;           /* # of times the entry was used */
+} *hashtab[NHASH];
+
+char *hashpath;         /* the PATH value used to fill hashtab */
+
+/*----------------------------------------*/
+/* Compute the hash table bucket for name. */
+/*----------------------------------------*/
+unsigned hashval(char *name)
+{
+    unsigned h;
+
+    for (h=0;*name!='\0';name++)
+        h = h * 31 + (unsigned char)*name;
+    return h % NHASH;
+}
+
+/*-----------------------------------------------*/
+/* Remove (and free) every entry in the table.   */
+/*-----------------------------------------------*/
+void hashflush(void)
+{
+    int i;
+    struct hashent *h, *next;
+
+    for (i=0;i<NHASH;i++) {
+        for (h=hashtab[i];h!=NULL;h=next) {
+            next = h->next;
+            free(h->name);
+            free(h->path);
+            free(h);
+        }
+        hashtab[i] = NULL;
+    }
+}
+
+/*--------------------------------------------------------------------*/
+/* Get the modification time of the directory in the first dlen chars */
+/* of p into *mt. Return 0 on success, or -1 if stat fails.           */
+/*--------------------------------------------------------------------*/
+int dirmtime(char *p, int dlen, struct timespec *mt)
+{
+    char dir[dlen+2];
+    struct stat sb;
+
+    if (dlen == 0)          /* e.g. "/ls" is in "/" */
+        strcpy(dir,"/");
+    else {
+        memcpy(dir,p,dlen);
+        dir[dlen] = '\0';
+    }
+    if (stat(dir,&sb) == -1)
+        return -1;
+    *mt = sb.st_mtim;
+    return 0;
+}
+
+/*-------------------------------------------------------------------*/
+/* Put in 'path' the first dlen chars of dir, a slash (if dlen isn't */
+/* 0), and name. The path buffer is made larger when necessary.      */
+/*-------------------------------------------------------------------*/
+void setpath(char *dir, int dlen, char *name)
+{
+    size_t n;
+
+    n = dlen + strlen(name) + 2;
+    if (n > pathsize) {
+        while (pathsize < n)
+            pathsize = pathsize > 0 ? 2 * pathsize : PATHSIZE;
+        free(path);
+        path = malloc(pathsize);
+        if (path == NULL) {
+            write(2,"*** ERROR: Out of memory.\n",26);
+            exit(1);
+        }
+    }
+    memcpy(path,dir,dlen);
+    if (dlen > 0)
+        path[dlen++] = '/';
+    strcpy(path+dlen,name);
+}
+
+/*-------------------------------------------------------------------*/
+/* Look for name in the hash table. If a valid entry is found, copy  */
+/* its path to 'path' and return 0. Otherwise return -1. Stale table */
+/* entries found during the search are removed.                      */
+/*-------------------------------------------------------------------*/
+int hashfind(char *name)
+{
+    char *pathenv;
+    struct hashent *h, **hp;
+    struct timespec mt;
+
+    pathenv = getvar("PATH");
+    if (pathenv == NULL)
+        pathenv = "";
+    if (hashpath == NULL || strcmp(hashpath,pathenv) != 0) {
+        hashflush();            /* PATH changed: forget everything */
+        free(hashpath);
+        hashpath = strdup(pathenv);
+        return -1;
+    }
+
+    for (hp=&hashtab[hashval(name)];(h=*hp)!=NULL;hp=&h->next) {
+        if (strcmp(h->name,name) != 0)
+            continue;
+        if (dirmtime(h->path,h->dlen,&mt) == -1
+                || mt.tv_sec != h->mtime.tv_sec
+                || mt.tv_nsec != h->mtime.tv_nsec) {
+            *hp = h->next;          /* directory changed; discard */
+            free(h->name);
+            free(h->path);
+            free(h);
+            return -1;
+        }
+        h->hits++;
+        setpath("",0,h->path);
+        return 0;
+    }
+    return -1;
+}
+
+/*----------------------------------------------------------------------*/
+/* Add name to the hash table. Its path is in 'path', and the directory */
+/* containing it is the first dlen characters of 'path'.                */
+/*----------------------------------------------------------------------*/
+void hashadd(char *name, int dlen)
+{
+    struct hashent *h;
+    unsigned b;
+
+    h = malloc(sizeof(struct hashent));
+    if (h == NULL)
+        return;             /* not cached; no harm done */
+    if (dirmtime(path,dlen,&h->mtime) == -1) {
+        free(h);
+        return;
     }
-    return 1;           /* success! */
+    h->name = strdup(name);
+    h->path = strdup(path);
+    h->dlen = dlen;
+    h->hits = 1;
+    b = hashval(name);
+    h->next = hashtab[b];
+    hashtab[b] = h;
 }
 
 /*--------------------------------------------------------------------------*/
-/* Put in 'path' the relative or absolute path to the command identified by */
-/* words[0]. If the file identified by 'path' is not executable, return -1. */
+/* Put in 'path' the relative or absolute path to the command named by     */
+/* 'name'. If the file identified by 'path' is not executable, return -1.   */
 /* Otherwise return 0.                                                      */
 /*--------------------------------------------------------------------------*/
 /* Note that 'path' is a global variable. When this function is used, it    */
 /* will overwrite any existing contents in that global variable. If there   */
 /* is "precious" data in 'path', then it may need to be saved elsewhere.    */
 /*--------------------------------------------------------------------------*/
-int execok(int w)
+int execok(char *name)
 {
     char *p;
     char *pathenv;
 
     /*-------------------------------------------------------*/
-    /* If words[0] is already a relative or absolute path... */
+    /* If name is already a relative or absolute path...    */
     /*-------------------------------------------------------*/
-    if (strchr(words[w],'/') != NULL) {     /* if it has no '/' */
-        strcpy(path,words[w]);          /* copy it to path */
+    if (strchr(name,'/') != NULL) {     /* if it has no '/' */
+        setpath("",0,name);         /* copy it to path */
         return access(path,X_OK);       /* return executable status */
     }
 
+    /*-------------------------------------------------------*/
+    /* If it was found before, use the remembered path.      */
+    /*-------------------------------------------------------*/
+    if (hashfind(name) == 0)
+        return 0;
+
     /*-------------------------------------------------------------------*/
     /* Otherwise search for a valid executable in the PATH directories.  */
     /* We do this by getting a COPY of the value of the PATH environment */
     /* variable, and checking each directory identified there to see it  */
-    /* contains an executable file named word[0]. If a directory does    */
+    /* contains an executable file named name. If a directory does    */
     /* have such a file, return 0. Otherwise, return -1. In either case, */
     /* always free the storage allocated for the value of PATH.          */
     /*-------------------------------------------------------------------*/
@@ -197,13 +1092,12 @@ int execok(int w)
     /* must be deallocated/freed in all cases. Otherwise the shell will  */
     /* have a "memory leak."                                             */
     /*-------------------------------------------------------------------*/
-    pathenv = strdup(getenv("PATH"));       /* get copy of PATH value */
+    pathenv = strdup(hashpath);         /* get copy of PATH value */
     p = strtok(pathenv,":");            /* find first directory */
     while (p != NULL) {
-        strcpy(path,p);             /* copy directory to path */
-        strcat(path,"/");           /* append a slash */
-        strcat(path,words[w]);          /* append executable's name */
+        setpath(p,strlen(p),name);  /* directory, slash, and name */
         if (access(path,X_OK) == 0) {       /* if it's executable */
+            hashadd(name,strlen(p));    /* remember where it is */
             free(pathenv);              /* free PATH copy */
             return 0;                   /* and return 0 */
         }
@@ -213,93 +1107,3156 @@ int execok(int w)
     return -1;                  /* say we didn't find it */
 }
 
-/*--------------------------------------------------*/
-/* Execute the command, if possible.                */
-/* If it is not executable, return -1.              */
-/* Otherwise return 0 if it completed successfully, */
-/* or 1 if it did not.                              */
-/*--------------------------------------------------*/
-/* This is the "meat" of the shell. It creates the  */
-/* child process to execute a command, and then it  */
-/* replaces the "cloned" shell in the child process */
-/*  with the executable program of the new command, */
-/* passing it the command line arguments and a copy */
-/* of the shell's environment.                      */
-/*--------------------------------------------------*/
-int execute(void)
+/*------------------------------------------------------------------*/
+/* Put in buf (of the given size) the text of the pipeline pl, with */
+/* one space between words.                                         */
+/*------------------------------------------------------------------*/
+void cmdtext(char *buf, int size, struct node *pl)
 {
-    int i, j;
-    int which, status;
-    pid_t pid;
-    char msg[100];
-    char *cmd[NWORDS];
-    char *w;
+    int k, n;
+    char **w, **argv;
 
-    i = 0;
-    while (i < nwds) {
-        if (execok(i) == 0) {            /* is it executable? */
-            j = 0;
-            for (;;) {                   /* yes; obtain arguments for command */
-                if (i >= nwds) {
-                    cmd[j] = NULL;
-                    break;
-                }
+    n = 0;
+    buf[0] = '\0';
+    for (k=0;k<pl->u.pipe.ns;k++) {
+        argv = pl->u.pipe.stage[k]->u.cmd.argv;
+        for (w=argv;*w!=NULL && n<size;w++)
+            n += snprintf(buf+n,size-n,"%s%s",
+                          n == 0 ? "" : w == argv ? " | " : " ", *w);
+    }
+}
 
-                w = words[i];
-                if (strcmp(w, ";") == 0) {
-                    cmd[j] = NULL;
-                    break;
-                } else if (strcmp(w, "&&") == 0) {
-                    cmd[j] = NULL;
-                    break;
-                } else if (strcmp(w, "||") == 0) {
-                    cmd[j] = NULL;
-                    break;
-                }
-                cmd[j] = w;
-                i++;
-                j++;
-            }
+/*------------------------------------------------------------------*/
+/* Resource accounting. Every command's processes are reaped with   */
+/* wait4, which gives their user and system CPU time and maximum    */
+/* resident set size; the shell measures the elapsed (real) time    */
+/* and the time it spent creating the processes ("spawn" time).     */
+/* These are displayed for commands prefixed by "time". With the    */
+/* -s option, a line for each command is also written to a CSV file, */
+/* and a summary with the slowest commands is displayed at the end. */
+/*------------------------------------------------------------------*/
+struct cstat {
+    char cmd[CMDLEN];       /* the command (perhaps truncated) */
+    int status;         /* its exit status */
+    double real;        /* elapsed time (seconds) */
+    double user;        /* user CPU time */
+    double sys;         /* system CPU time */
+    double spawn;       /* time spent creating processes */
+    long maxrss;        /* max resident set size (kB) of any process */
+};
 
-            pid = fork();            /* create a new process */
+int dostats;        /* non-zero if the -s option was specified */
+int statfd = -1;        /* the -s CSV file */
+struct cstat slow[NSLOW];   /* slowest commands, slowest first */
+int nslow;          /* # of entries in slow */
+long ncmds;         /* # of commands accounted for */
+double totreal, totuser, totsys, totspawn;  /* their total times */
 
-            if (pid == -1) {         /* verify fork succeeded */
-                perror("fork");
-                exit(1);
-            } else if (pid == 0) {
-                status = execve(path,cmd,environ); /* try to execute it */
+/*-----------------------------------------------------*/
+/* Return the seconds from *t0 to *t1 (as a double). */
+/*-----------------------------------------------------*/
+double elapsed(struct timespec *t0, struct timespec *t1)
+{
+    return (t1->tv_sec - t0->tv_sec) + (t1->tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+/*------------------------------------------------------------------*/
+/* Convert a status from wait to a command's exit status: the value */
+/* given to exit, or 128 plus the number of the signal that ended   */
+/* the process.                                                     */
+/*------------------------------------------------------------------*/
+int exitstatus(int st)
+{
+    if (WIFSIGNALED(st))
+        return 128 + WTERMSIG(st);
+    return WEXITSTATUS(st);
+}
+
+/*--------------------------------------------------------------*/
+/* Add the CPU times and size in *ru to the statistics in *cs. */
+/*--------------------------------------------------------------*/
+void addusage(struct cstat *cs, struct rusage *ru)
+{
+    cs->user += ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6;
+    cs->sys += ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6;
+    if (ru->ru_maxrss > cs->maxrss)
+        cs->maxrss = ru->ru_maxrss;
+}
+
+/*-------------------------------------------------------------*/
+/* Account for the command described by *cs: add it to the    */
+/* totals and the list of slowest commands.                    */
+/*-------------------------------------------------------------*/
+void account(struct cstat *cs)
+{
+    int k;
+
+    ncmds++;
+    totreal += cs->real;
+    totuser += cs->user;
+    totsys += cs->sys;
+    totspawn += cs->spawn;
+
+    for (k=nslow;k>0 && slow[k-1].real<cs->real;k--)
+        if (k < NSLOW)
+            slow[k] = slow[k-1];
+    if (k < NSLOW) {
+        slow[k] = *cs;
+        if (nslow < NSLOW)
+            nslow++;
+    }
+}
+
+/*------------------------------------------------------------------*/
+/* Write the CSV file line for the command described by *cs. Each   */
+/* line is written with one write (the file was opened for          */
+/* appending), so lines from different processes don't mix.        */
+/*------------------------------------------------------------------*/
+void putrow(struct cstat *cs)
+{
+    char buf[2*CMDLEN+128];
+    char *p, *q;
+
+    if (statfd == -1)
+        return;
+    p = buf;
+    *p++ = '"';
+    for (q=cs->cmd;*q!='\0';q++) {  /* quote the command for CSV */
+        if (*q == '"')
+            *p++ = '"';
+        *p++ = *q;
+    }
+    p += sprintf(p,"\",%d,%.6f,%.6f,%.6f,%.6f,%ld\n", cs->status,
+                 cs->real, cs->user, cs->sys, cs->spawn, cs->maxrss);
+    write(statfd,buf,p-buf);
+}
+
+/*------------------------------------------------------*/
+/* Display the times for a command prefixed by "time". */
+/*------------------------------------------------------*/
+void puttime(struct cstat *cs)
+{
+    fprintf(stderr,"real\t%dm%.3fs\nuser\t%dm%.3fs\nsys\t%dm%.3fs\n"
+            "maxrss\t%ldk\n",
+            (int)(cs->real/60), cs->real - 60*(int)(cs->real/60),
+            (int)(cs->user/60), cs->user - 60*(int)(cs->user/60),
+            (int)(cs->sys/60), cs->sys - 60*(int)(cs->sys/60), cs->maxrss);
+}
+
+/*------------------------------------------------------------------*/
+/* Display (on the standard error) the summary of all the commands  */
+/* accounted for, if the -s option was specified. In -j mode, each  */
+/* line process counts as one command.                              */
+/*------------------------------------------------------------------*/
+void statsummary(void)
+{
+    int k;
+
+    if (!dostats || subshell)
+        return;
+    fprintf(stderr,"--- %ld commands: real %.3fs, user %.3fs, sys %.3fs\n",
+            ncmds, totreal, totuser, totsys);
+    fprintf(stderr,"--- spawn overhead %.3fs (%.1f us per command)\n",
+            totspawn, ncmds ? totspawn / ncmds * 1e6 : 0.0);
+    if (nslow > 0)
+        fprintf(stderr,"--- slowest commands:\n");
+    for (k=0;k<nslow;k++)
+        fprintf(stderr,"%10.3fs  %s\n", slow[k].real, slow[k].cmd);
+    dostats = 0;           /* display it only once */
+}
+
+/*------------------------------------------------------------------*/
+/* A pipeline followed by "&" is a background job: the shell starts */
+/* it and goes on to the next command without waiting. Each job has */
+/* an entry in the job table. jobs[k] is job number k+1; an entry   */
+/* with npids == 0 is unused. Finished processes are reaped (with   */
+/* waitpid and WNOHANG) each time the shell gets a command line, so */
+/* the shell never blocks on a background job unless asked to (by   */
+/* the wait or fg commands).                                        */
+/*------------------------------------------------------------------*/
+struct job {
+    int npids;          /* # of processes in the job (0 = unused) */
+    pid_t *pids;        /* process IDs; 0 once a process is reaped */
+    int nleft;          /* # of processes not yet reaped */
+    int status;         /* status of the last process */
+    char cmd[CMDLEN];       /* the command, for display */
+} jobs[NJOBS];
+
+int njobs;          /* # of jobs in the table */
+
+/*-------------------------------------------------------------------*/
+/* Add a job with the ns process IDs in pid (0 for a command that    */
+/* never started) running the pipeline pl. Return the job's          */
+/* number, or 0 if the job table is full (the job still runs, but    */
+/* its processes won't be reaped until the shell ends).              */
+/*-------------------------------------------------------------------*/
+int addjob(int ns, pid_t *pid, struct node *pl)
+{
+    struct job *jp;
+    int j, k;
+
+    for (j=0;j<NJOBS && jobs[j].npids!=0;j++)
+        ;
+    if (j == NJOBS) {
+        fprintf(stderr,"*** ERROR: Too many jobs.\n");
+        return 0;
+    }
+    jp = &jobs[j];
+    jp->pids = malloc(ns*sizeof(pid_t));
+    if (jp->pids == NULL) {
+        fprintf(stderr,"*** ERROR: Out of memory.\n");
+        return 0;
+    }
+    jp->npids = ns;
+    jp->nleft = 0;
+    jp->status = 0;
+    for (k=0;k<ns;k++) {
+        jp->pids[k] = pid[k];
+        if (pid[k] != 0)
+            jp->nleft++;
+    }
+
+    cmdtext(jp->cmd,sizeof(jp->cmd),pl);
+    njobs++;
+    return j+1;
+}
+
+/*----------------------------------------------------------------*/
+/* Record that process pid ended with status st. Return the job   */
+/* the process belongs to, or NULL if it isn't in any job.        */
+/*----------------------------------------------------------------*/
+struct job *jobdone(pid_t pid, int st)
+{
+    int j, k;
+
+    for (j=0;j<NJOBS;j++)
+        for (k=0;k<jobs[j].npids;k++)
+            if (jobs[j].pids[k] == pid) {
+                jobs[j].pids[k] = 0;
+                jobs[j].nleft--;
+                if (k == jobs[j].npids-1)
+                    jobs[j].status = st;
+                return &jobs[j];
+            }
+    return NULL;
+}
+
+/*-------------------------------------------------------------*/
+/* Remove job jp from the table. If verbose, tell the user the */
+/* job has finished.                                           */
+/*-------------------------------------------------------------*/
+void freejob(struct job *jp, int verbose)
+{
+    if (verbose)
+        printf("[%d] Done\t%s\n", (int)(jp - jobs) + 1, jp->cmd);
+    free(jp->pids);
+    jp->npids = 0;
+    njobs--;
+}
+
+/*------------------------------------------------------------------*/
+/* In parallel mode (-j N), each command line is executed by a copy */
+/* of the shell (a "line process"), and up to N line processes run  */
+/* at once. The && and || operators work as usual within a line,    */
+/* since one line process executes the whole line. Lines starting   */
+/* with a builtin command are executed by the shell itself once all */
+/* earlier lines are done, so commands like cd and wait still apply */
+/* to the lines that follow them.                                   */
+/*                                                                  */
+/* With -o, each line process writes its output (and the echoed     */
+/* input line) to a memory file instead of the standard output. The */
+/* shell copies each memory file to the standard output once the    */
+/* line is done and all earlier lines' output has been copied, so   */
+/* the output appears exactly as if the lines ran one at a time.    */
+/*                                                                  */
+/* Line processes are kept in 'pq', a circular queue in input order: */
+/* pq[pqhead] is the oldest, and there are pqlen of them.           */
+/*------------------------------------------------------------------*/
+struct pline {
+    pid_t pid;          /* line process ID */
+    int fd;         /* memory file with its output, or -1 */
+    int done;           /* non-zero once it has ended */
+    struct timespec start;  /* when it was started (for -s) */
+    double spawn;       /* time taken to create it (for -s) */
+    char cmd[CMDLEN];       /* the line (for -s) */
+} pq[PQSIZE];
+
+int pqhead;         /* index of oldest entry in pq */
+int pqlen;          /* # of entries in pq */
+int nrunning;           /* # of line processes not yet ended */
+int maxpar;         /* the N of -j N (0 = not parallel) */
+int serialize;          /* non-zero if the -o option was specified */
+
+/*------------------------------------------------------------------*/
+/* Copy the contents of the memory file fd to the file out.          */
+/* sendfile does this without copying through the shell's memory,   */
+/* but it refuses some outputs (e.g. files opened for appending), so */
+/* read and write are used when it fails.                            */
+/*------------------------------------------------------------------*/
+void copyout(int fd, int out)
+{
+    off_t off;
+    ssize_t n;
+    char buf[4096];
+    struct stat sb;
+
+    if (fstat(fd,&sb) == -1)
+        return;
+    off = 0;
+    while (off < sb.st_size) {
+        n = sendfile(out,fd,&off,sb.st_size-off);
+        if (n <= 0)
+            break;
+    }
+    while (off < sb.st_size) {
+        n = pread(fd,buf,sizeof(buf),off);
+        if (n <= 0 || write(out,buf,n) != n)
+            break;
+        off += n;
+    }
+}
+
+/*------------------------------------------------------------------*/
+/* Write the output of finished line processes, in input order, and */
+/* remove them from pq. Stop at the first line still running.       */
+/*------------------------------------------------------------------*/
+void pemit(void)
+{
+    struct pline *pl;
+
+    fflush(stdout);
+    while (pqlen > 0 && pq[pqhead].done) {
+        pl = &pq[pqhead];
+        if (pl->fd != -1) {
+            copyout(pl->fd,1);
+            close(pl->fd);
+        }
+        pqhead = (pqhead + 1) % PQSIZE;
+        pqlen--;
+    }
+}
+
+/*------------------------------------------------------------------*/
+/* Record that process pid ended with status st, having used the    */
+/* resources in *ru. Return 1 if it was a line process, or 0 if it  */
+/* was part of a background job (or unknown).                       */
+/*------------------------------------------------------------------*/
+/* With -s, each line process is accounted for as one command. The  */
+/* line process writes the CSV lines for its own commands.          */
+/*------------------------------------------------------------------*/
+int childdone(pid_t pid, int st, struct rusage *ru)
+{
+    int k, q;
+    struct job *jp;
+    struct cstat cs;
+    struct timespec t1;
+
+    for (k=0;k<pqlen;k++) {
+        q = (pqhead + k) % PQSIZE;
+        if (pq[q].pid == pid && !pq[q].done) {
+            pq[q].done = 1;
+            nrunning--;
+            if (dostats) {
+                memset(&cs,0,sizeof(cs));
+                clock_gettime(CLOCK_MONOTONIC,&t1);
+                strcpy(cs.cmd,pq[q].cmd);
+                cs.status = exitstatus(st);
+                cs.real = elapsed(&pq[q].start,&t1);
+                cs.spawn = pq[q].spawn;
+                addusage(&cs,ru);
+                account(&cs);
+            }
+            return 1;
+        }
+    }
+
+    jp = jobdone(pid,st);
+    if (jp != NULL && jp->nleft == 0)
+        freejob(jp,isterm);
+    return 0;
+}
+
+/*------------------------------------------------------------------*/
+/* Reap every background process (and line process) that has        */
+/* ended, without waiting. Finished jobs are removed from the table; */
+/* if the input is from a terminal, the user is told about them.    */
+/*------------------------------------------------------------------*/
+void reapjobs(void)
+{
+    pid_t pid;
+    int st;
+    struct rusage ru;
+
+    while ((njobs > 0 || nrunning > 0)
+           && (pid = wait4(-1,&st,WNOHANG,&ru)) > 0)
+        childdone(pid,st,&ru);
+    pemit();
+}
+
+/*------------------------------------------------------------------*/
+/* Wait for every process in job jp to end, and remove the job from */
+/* the table. Return the status of the job's last process.          */
+/*------------------------------------------------------------------*/
+int waitjob(struct job *jp)
+{
+    int k, st;
+
+    for (k=0;k<jp->npids;k++) {
+        if (jp->pids[k] == 0)
+            continue;
+        if (waitpid(jp->pids[k],&st,0) == -1) {
+            write(2,"Wait failed.\n",13);
+            exit(1);
+        }
+        jobdone(jp->pids[k],st);
+    }
+    st = jp->status;
+    freejob(jp,0);
+    return st;
+}
+
+/*------------------------------------------------------------------*/
+/* Return the job identified by s ("%n" or "n" for job n, or the    */
+/* process ID of one of the job's processes), or NULL if there's no */
+/* such job.                                                        */
+/*------------------------------------------------------------------*/
+struct job *findjob(char *s)
+{
+    int j, k, n;
+
+    if (*s == '%') {
+        n = atoi(s+1);
+        if (n >= 1 && n <= NJOBS && jobs[n-1].npids != 0)
+            return &jobs[n-1];
+        return NULL;
+    }
+    n = atoi(s);
+    for (j=0;j<NJOBS;j++)
+        for (k=0;k<jobs[j].npids;k++)
+            if (jobs[j].pids[k] != 0 && jobs[j].pids[k] == n)
+                return &jobs[j];
+    if (n >= 1 && n <= NJOBS && jobs[n-1].npids != 0)
+        return &jobs[n-1];
+    return NULL;
+}
+
+/*------------------------------------------------------------------*/
+/* Builtin commands are executed by the shell itself, without       */
+/* creating a child process. Each function is given the command's   */
+/* argument count and arguments (as for main), and returns the      */
+/* command's exit status (0 for success).                           */
+/*------------------------------------------------------------------*/
+
+/*------------------------------------------------------------------*/
+/* hash: display the command hash table.                            */
+/* hash -r: discard all entries in the command hash table.          */
+/* hash name...: find each named command and add it to the table.   */
+/*------------------------------------------------------------------*/
+int bi_hash(int argc, char *argv[])
+{
+    int i, status;
+    struct hashent *h;
+
+    if (argc == 2 && !strcmp(argv[1],"-r")) {
+        hashflush();
+        return 0;
+    }
+
+    if (argc == 1) {
+        hashfind("");           /* discard table if PATH changed */
+        for (i=0;i<NHASH;i++)
+            for (h=hashtab[i];h!=NULL;h=h->next) {
+                if (argc == 1)
+                    printf("hits\tcommand\n");
+                argc++;         /* header is displayed once */
+                printf("%4d\t%s\n", h->hits, h->path);
+            }
+        if (argc == 1)
+            printf("hash: hash table empty\n");
+        fflush(stdout);
+        return 0;
+    }
+
+    status = 0;
+    for (i=1;i<argc;i++) {
+        if (strchr(argv[i],'/') != NULL || execok(argv[i]) != 0) {
+            fprintf(stderr,"hash: %s: not found\n", argv[i]);
+            status = 1;
+        }
+    }
+    return status;
+}
+
+/*---------------------------------------------------------*/
+/* jobs: display the background jobs, and whether they are */
+/* still running. Finished jobs are then removed.          */
+/*---------------------------------------------------------*/
+int bi_jobs(int argc, char *argv[])
+{
+    int j;
+
+    (void)argc;
+    (void)argv;
+    reapjobs();
+    for (j=0;j<NJOBS;j++)
+        if (jobs[j].npids != 0)
+            printf("[%d] %s\t%s\n", j+1,
+                   jobs[j].nleft > 0 ? "Running" : "Done", jobs[j].cmd);
+    for (j=0;j<NJOBS;j++)
+        if (jobs[j].npids != 0 && jobs[j].nleft == 0)
+            freejob(&jobs[j],0);
+    fflush(stdout);
+    return 0;
+}
+
+/*-----------------------------------------------------------------*/
+/* wait: wait for all background jobs to end.                      */
+/* wait job...: wait for each job (%n, or a process ID) to end.    */
+/* The exit status is that of the last job waited for.             */
+/*-----------------------------------------------------------------*/
+int bi_wait(int argc, char *argv[])
+{
+    int i, j, st;
+    struct job *jp;
+
+    st = 0;
+    if (argc == 1) {
+        for (j=0;j<NJOBS;j++)
+            if (jobs[j].npids != 0)
+                st = exitstatus(waitjob(&jobs[j]));
+        return st;
+    }
+    for (i=1;i<argc;i++) {
+        jp = findjob(argv[i]);
+        if (jp == NULL) {
+            fprintf(stderr,"wait: %s: no such job\n", argv[i]);
+            st = 127;
+        } else
+            st = exitstatus(waitjob(jp));
+    }
+    return st;
+}
+
+/*-----------------------------------------------------------------*/
+/* fg [job]: bring a job (by default, the most recent one) into    */
+/* the foreground; that is, display it and wait for it to end.     */
+/* The shell has no terminal job control, so nothing else changes. */
+/*-----------------------------------------------------------------*/
+int bi_fg(int argc, char *argv[])
+{
+    int j;
+    struct job *jp;
+
+    if (argc > 1)
+        jp = findjob(argv[1]);
+    else {
+        jp = NULL;
+        for (j=0;j<NJOBS;j++)
+            if (jobs[j].npids != 0)
+                jp = &jobs[j];
+    }
+    if (jp == NULL) {
+        fprintf(stderr,"fg: %s: no such job\n", argc > 1 ? argv[1] : "current");
+        return 1;
+    }
+    printf("%s\n", jp->cmd);
+    fflush(stdout);
+    return exitstatus(waitjob(jp));
+}
+
+/*------------------------------------------------------------------*/
+/* cd [dir]: change the shell's working directory to dir (or to the */
+/* value of HOME). If PATH has relative directories, the command    */
+/* hash table is flushed, as its relative paths are now wrong.      */
+/*------------------------------------------------------------------*/
+int bi_cd(int argc, char *argv[])
+{
+    char *dir, *p;
+
+    dir = argc > 1 ? argv[1] : getvar("HOME");
+    if (dir == NULL) {
+        fprintf(stderr,"cd: HOME not set\n");
+        return 1;
+    }
+    if (chdir(dir) == -1) {
+        fprintf(stderr,"cd: %s: %s\n", dir, strerror(errno));
+        return 1;
+    }
+    if (cwdfd != -1) {          /* the fork server needs the new one */
+        close(cwdfd);
+        cwdfd = -1;
+    }
+    for (p=hashpath;p!=NULL;p=strchr(p,':')) {
+        if (*p == ':')
+            p++;
+        if (*p != '/') {
+            hashflush();
+            break;
+        }
+    }
+    return 0;
+}
+
+/*-----------------------------------------------------*/
+/* echo [-n] [arg...]: display the arguments, with a   */
+/* space between each, and (unless -n) an end of line. */
+/*-----------------------------------------------------*/
+int bi_echo(int argc, char *argv[])
+{
+    int i, nl;
+
+    nl = 1;
+    i = 1;
+    if (argc > 1 && !strcmp(argv[1],"-n")) {
+        nl = 0;
+        i++;
+    }
+    for (;i<argc;i++) {
+        fputs(argv[i],stdout);
+        if (i < argc-1)
+            putchar(' ');
+    }
+    if (nl)
+        putchar('\n');
+    fflush(stdout);
+    return 0;
+}
+
+/*------------------------------------------------------------------*/
+/* export [NAME[=value]...]: export each variable NAME (first       */
+/* setting it, if a value is given), so programs get it in their    */
+/* environment. With no arguments, display the exported variables.  */
+/*------------------------------------------------------------------*/
+int bi_export(int argc, char *argv[])
+{
+    struct var *v;
+    char **e;
+    int k, n, st;
+
+    if (argc == 1) {
+        for (e=getenvp();*e!=NULL;e++)
+            printf("export %s\n", *e);
+        fflush(stdout);
+        return 0;
+    }
+    st = 0;
+    for (k=1;k<argc;k++) {
+        n = namelen(argv[k]);
+        if (n > 0 && argv[k][n] == '=')
+            setvar(argv[k],1);
+        else if (n > 0 && argv[k][n] == '\0') {
+            v = findvar(argv[k],n);
+            if (v->str != NULL && !v->exported) {
+                v->exported = 1;
+                envdirty = 1;
+            }
+        } else {
+            fprintf(stderr,"export: %s: bad variable name\n", argv[k]);
+            st = 1;
+        }
+    }
+    return st;
+}
+
+/*-----------------------------------------------*/
+/* unset NAME...: remove the variables NAME ...  */
+/*-----------------------------------------------*/
+int bi_unset(int argc, char *argv[])
+{
+    int k;
+
+    for (k=1;k<argc;k++)
+        unsetvar(argv[k]);
+    return 0;
+}
+
+/*------------------------------------------------------------------*/
+/* NAME=value ...: a command made only of assignments sets the      */
+/* variables (in the shell, unless it's part of a pipeline).        */
+/*------------------------------------------------------------------*/
+int bi_assign(int argc, char *argv[])
+{
+    int k;
+
+    for (k=0;k<argc;k++)
+        setvar(argv[k],0);
+    return 0;
+}
+
+/*------------------------------------------------------------------*/
+/* exit [n]: end the shell with exit status n (default 0). Any      */
+/* output not yet written is written first.                         */
+/*------------------------------------------------------------------*/
+int bi_exit(int argc, char *argv[])
+{
+    if (curclient != NULL) {        /* just end the connection */
+        clientquit = 1;
+        return argc > 1 ? atoi(argv[1]) & 0377 : 0;
+    }
+    fflush(stdout);
+    flushecho();
+    statsummary();
+    exit(argc > 1 ? atoi(argv[1]) & 0377 : 0);
+}
+
+int bi_true(int argc, char *argv[])
+{
+    (void)argc;
+    (void)argv;
+    return 0;
+}
+
+int bi_false(int argc, char *argv[])
+{
+    (void)argc;
+    (void)argv;
+    return 1;
+}
+
+/*------------------------------------------------------------------*/
+/* Evaluate the expression for test (or "["), in argv[0..argc-1].   */
+/* Return 0 if it is true, 1 if false, or 2 if it isn't understood. */
+/* The forms recognized are:                                        */
+/*   (nothing)          false                                       */
+/*   ! expr             the opposite of expr                        */
+/*   s                  s is not empty                              */
+/*   -n s, -z s         s is not empty, s is empty                  */
+/*   -e, -f, -d, -s f   f exists, is a regular file, is a           */
+/*                      directory, has a size greater than zero     */
+/*   -r, -w, -x f       f is readable, writable, executable         */
+/*   s1 = s2, s1 != s2  the strings are equal, not equal            */
+/*   n1 -eq n2 (also -ne, -lt, -le, -gt, -ge)  integer comparisons  */
+/*------------------------------------------------------------------*/
+int testexpr(int argc, char *argv[])
+{
+    struct stat sb;
+    char *op;
+    long a, b;
+    int r;
+
+    if (argc == 0)
+        return 1;
+    if (!strcmp(argv[0],"!")) {
+        r = testexpr(argc-1,argv+1);
+        return r == 2 ? 2 : !r;
+    }
+    if (argc == 1)
+        return argv[0][0] == '\0';
+
+    if (argc == 2) {
+        op = argv[0];
+        if (!strcmp(op,"-n"))
+            return argv[1][0] == '\0';
+        if (!strcmp(op,"-z"))
+            return argv[1][0] != '\0';
+        if (!strcmp(op,"-r"))
+            return access(argv[1],R_OK) != 0;
+        if (!strcmp(op,"-w"))
+            return access(argv[1],W_OK) != 0;
+        if (!strcmp(op,"-x"))
+            return access(argv[1],X_OK) != 0;
+        if (op[0] != '-' || op[1] == '\0' || op[2] != '\0'
+                || strchr("efds",op[1]) == NULL)
+            return 2;
+        if (stat(argv[1],&sb) == -1)
+            return 1;
+        switch (op[1]) {
+            case 'e': return 0;
+            case 'f': return !S_ISREG(sb.st_mode);
+            case 'd': return !S_ISDIR(sb.st_mode);
+            default:  return sb.st_size == 0;
+        }
+    }
+
+    if (argc == 3) {
+        op = argv[1];
+        if (!strcmp(op,"="))
+            return strcmp(argv[0],argv[2]) != 0;
+        if (!strcmp(op,"!="))
+            return strcmp(argv[0],argv[2]) == 0;
+        a = atol(argv[0]);
+        b = atol(argv[2]);
+        if (!strcmp(op,"-eq")) return !(a == b);
+        if (!strcmp(op,"-ne")) return !(a != b);
+        if (!strcmp(op,"-lt")) return !(a < b);
+        if (!strcmp(op,"-le")) return !(a <= b);
+        if (!strcmp(op,"-gt")) return !(a > b);
+        if (!strcmp(op,"-ge")) return !(a >= b);
+    }
+    return 2;
+}
+
+/*---------------------------------------------------------*/
+/* test expr, or [ expr ]: see testexpr. An expression the */
+/* shell doesn't understand is diagnosed (exit status 2).  */
+/*---------------------------------------------------------*/
+int bi_test(int argc, char *argv[])
+{
+    int r;
+
+    if (!strcmp(argv[0],"[")) {
+        if (strcmp(argv[argc-1],"]") != 0) {
+            fprintf(stderr,"[: missing ]\n");
+            return 2;
+        }
+        argc--;
+    }
+    r = testexpr(argc-1,argv+1);
+    if (r == 2)
+        fprintf(stderr,"%s: bad expression\n", argv[0]);
+    return r;
+}
+
+int bi_source(int argc, char *argv[]);     /* defined below */
+
+struct builtin {
+    char *name;         /* command name */
+    int (*func)(int, char **);  /* function that executes it */
+} builtins[] = {
+    { ".", bi_source },
+    { "[", bi_test },
+    { "cd", bi_cd },
+    { "echo", bi_echo },
+    { "exit", bi_exit },
+    { "export", bi_export },
+    { "false", bi_false },
+    { "fg", bi_fg },
+    { "hash", bi_hash },
+    { "jobs", bi_jobs },
+    { "source", bi_source },
+    { "test", bi_test },
+    { "true", bi_true },
+    { "unset", bi_unset },
+    { "wait", bi_wait },
+    { NULL, NULL }
+};
+
+struct builtin assignb = { "=", bi_assign };    /* for NAME=value ... */
+
+/*------------------------------------------------------------*/
+/* Return the builtins entry for the command name, or NULL if */
+/* name isn't a builtin command.                              */
+/*------------------------------------------------------------*/
+struct builtin *findbuiltin(char *name)
+{
+    struct builtin *b;
+
+    for (b=builtins;b->name!=NULL;b++)
+        if (!strcmp(b->name,name))
+            return b;
+    return NULL;
+}
+
+/*-----------------------------------------------------------*/
+/* Return non-zero if w is a sequencing operator (";", "&",  */
+/* "&&", or "||"), and 0 otherwise.                          */
+/*-----------------------------------------------------------*/
+int isop(char *w)
+{
+    return !strcmp(w,";") || !strcmp(w,"&") || !strcmp(w,"&&")
+        || !strcmp(w,"||");
+}
+
+/*------------------------------------------------------------------*/
+/* If the word w starts with a redirection operator ("<", ">", ">>", */
+/* "<<" or ">&", perhaps after a descriptor number 0, 1 or 2), set  */
+/* r's type and fd and return the length of the operator. Return 0 */
+/* if w isn't a redirection.                                        */
+/*------------------------------------------------------------------*/
+int isredir(char *w, struct redir *r)
+{
+    int n;
+
+    n = 0;
+    r->fd = -1;
+    if (w[0] >= '0' && w[0] <= '2' && (w[1] == '<' || w[1] == '>')) {
+        r->fd = w[0] - '0';
+        n = 1;
+    }
+    if (w[n] == '<') {
+        r->type = w[n+1] == '<' ? R_HEREDOC : R_IN;
+        n += r->type == R_HEREDOC ? 2 : 1;
+        if (r->fd == -1)
+            r->fd = 0;
+    } else if (w[n] == '>') {
+        r->type = w[n+1] == '>' ? R_APPEND : w[n+1] == '&' ? R_DUP : R_OUT;
+        n += r->type == R_OUT ? 1 : 2;
+        if (r->fd == -1)
+            r->fd = 1;
+    } else
+        return 0;
+    return n;
+}
+
+/*------------------------------------------------------------------*/
+/* Parse the n words in w (n > 0) as a command with its arguments   */
+/* and redirections, and any NAME=value assignments before the      */
+/* command name, with memory allocated from arena a. A command      */
+/* that's only assignments is run by the assignb builtin. The       */
+/* target of a redirection may be in the same word as the operator  */
+/* (">f") or the next word ("> f"). Return the N_CMD node, or NULL  */
+/* (after displaying a message) if there's an error. Here-documents */
+/* are added to the heredocs list, for the caller to read.          */
+/*------------------------------------------------------------------*/
+struct node *parsecmd(struct arena *a, char **w, int n)
+{
+    struct node *c;
+    struct redir r, *rp, **last;
+    int i, k, len;
+
+    c = aalloc(a,sizeof(struct node));
+    c->type = N_CMD;
+    c->u.cmd.argc = 0;
+    c->u.cmd.argv = aalloc(a,(n+1)*sizeof(char *));
+    c->u.cmd.redir = NULL;
+    c->u.cmd.nredir = 0;
+    c->u.cmd.assign = aalloc(a,(n+1)*sizeof(char *));
+    c->u.cmd.nassign = 0;
+    last = &c->u.cmd.redir;
+    for (i=0;i<n;i++) {
+        len = isredir(w[i],&r);
+        if (len == 0 && c->u.cmd.argc == 0 && isassign(w[i])) {
+            c->u.cmd.assign[c->u.cmd.nassign++] = w[i];
+            continue;
+        }
+        if (len == 0) {         /* an ordinary word */
+            c->u.cmd.argv[c->u.cmd.argc++] = w[i];
+            continue;
+        }
+        r.word = w[i] + len;
+        if (*r.word == '\0') {      /* target is the next word */
+            if (i+1 == n) {
+                fprintf(stderr,"*** ERROR: Missing word after '%s'.\n", w[i]);
+                return NULL;
+            }
+            r.word = w[++i];
+        }
+        if (r.type == R_DUP) {
+            k = r.word[0] - '0';
+            if (k < 0 || k > 2 || r.word[1] != '\0') {
+                fprintf(stderr,"*** ERROR: Bad descriptor in '%s'.\n", w[i]);
+                return NULL;
+            }
+            r.from = k;
+        }
+        rp = aalloc(a,sizeof(struct redir));
+        *rp = r;
+        rp->next = NULL;
+        rp->nextdoc = NULL;
+        rp->text = NULL;
+        rp->len = 0;
+        *last = rp;
+        last = &rp->next;
+        c->u.cmd.nredir++;
+        if (r.type == R_HEREDOC) {
+            *lastdoc = rp;
+            lastdoc = &rp->nextdoc;
+        }
+    }
+    c->u.cmd.argv[c->u.cmd.argc] = NULL;
+    c->u.cmd.assign[c->u.cmd.nassign] = NULL;
+    if (c->u.cmd.argc == 0 && c->u.cmd.nassign == 0) {
+        write(2,"*** ERROR: Missing command.\n",28);
+        return NULL;
+    }
+    if (c->u.cmd.argc == 0) {       /* just assignments */
+        c->u.cmd.argv = c->u.cmd.assign;
+        c->u.cmd.argc = c->u.cmd.nassign;
+        c->u.cmd.nassign = 0;
+        c->u.cmd.b = &assignb;
+        return c;
+    }
+    c->u.cmd.b = findbuiltin(c->u.cmd.argv[0]);
+    return c;
+}
+
+/*------------------------------------------------------------------*/
+/* Parse the n words in w (which contain no sequencing operators)   */
+/* as a pipeline, with nodes allocated from arena a. The words      */
+/* themselves aren't copied. Return the N_PIPE node, or NULL (after */
+/* displaying a message) if a command is missing. op is the         */
+/* operator after the pipeline, for the message.                    */
+/*------------------------------------------------------------------*/
+struct node *parsepipe(struct arena *a, char **w, int n, char *op)
+{
+    struct node *pl, *c;
+    int i, j, k, m, ns, timed;
+    char msg[100];
+
+    timed = n > 0 && !strcmp(w[0],"time");
+    if (timed) {
+        w++;
+        n--;
+        if (n == 0) {
+            write(2,"*** ERROR: Missing command after 'time'.\n",41);
+            return NULL;
+        }
+    }
+
+    ns = 1;
+    for (i=0;i<n;i++)
+        if (!strcmp(w[i],"|"))
+            ns++;
+
+    pl = aalloc(a,sizeof(struct node));
+    pl->type = N_PIPE;
+    pl->u.pipe.ns = ns;
+    pl->u.pipe.timed = timed;
+    pl->u.pipe.dollar = 0;
+    pl->u.pipe.wild = 0;
+    pl->u.pipe.stage = aalloc(a,ns*sizeof(struct node *));
+
+    i = 0;
+    for (k=0;k<ns;k++) {
+        for (j=i;j<n && strcmp(w[j],"|")!=0;j++)
+            ;
+        if (j == i) {       /* no words for this command */
+            if (ns == 1)
+                sprintf(msg,"*** ERROR: '%s' cannot be executed.\n",
+                        op != NULL ? op : "");
+            else
+                sprintf(msg,"*** ERROR: Missing command in pipeline.\n");
+            write(2,msg,strlen(msg));
+            return NULL;
+        }
+        c = parsecmd(a,w+i,j-i);
+        if (c == NULL)
+            return NULL;
+        for (m=0;m<c->u.cmd.argc;m++) {
+            if (strchr(c->u.cmd.argv[m],'$') != NULL)
+                pl->u.pipe.dollar = 1;
+            if (c->u.cmd.b != &assignb
+                    && strpbrk(c->u.cmd.argv[m],"*?[") != NULL)
+                pl->u.pipe.wild = 1;
+        }
+        for (m=0;m<c->u.cmd.nassign;m++)
+            if (strchr(c->u.cmd.assign[m],'$') != NULL)
+                pl->u.pipe.dollar = 1;
+        pl->u.pipe.stage[k] = c;
+        i = j + 1;
+    }
+    return pl;
+}
+
+/*------------------------------------------------------------------*/
+/* Parse the nw words in w (from lex) into a tree of nodes, which   */
+/* are allocated from arena a. Return the root of the tree, or NULL */
+/* if the line is empty or has an error (a message is displayed).   */
+/* The tree refers to the words, which must remain unchanged for as */
+/* long as the tree is used. The here-documents on the line are put */
+/* on the heredocs list; the caller must read their text.           */
+/*------------------------------------------------------------------*/
+struct node *parse(struct arena *a, char **w, int nw)
+{
+    struct node *root, **link, *pl, *op;
+    int i, j;
+
+    root = NULL;
+    link = &root;
+    heredocs = NULL;
+    lastdoc = &heredocs;
+    for (i=0;i<nw;i=j+1) {
+        for (j=i;j<nw && !isop(w[j]);j++)   /* find end of pipeline */
+            ;
+        pl = parsepipe(a,w+i,j-i,j < nw ? w[j] : NULL);
+        if (pl == NULL)
+            return NULL;
+        if (j == nw) {          /* last pipeline, no operator */
+            *link = pl;
+            break;
+        }
+        op = aalloc(a,sizeof(struct node));
+        op->type = !strcmp(w[j],";") ? N_SEQ : !strcmp(w[j],"&") ? N_BG
+                   : !strcmp(w[j],"&&") ? N_AND : N_OR;
+        op->u.op.left = pl;
+        op->u.op.right = NULL;
+        *link = op;
+        link = &op->u.op.right;
+    }
+    return root;
+}
+
+/*------------------------------------------------------------------*/
+/* Put every here-document on the line in the nw words w on the      */
+/* heredocs list, with memory from arena a. This is used when parse  */
+/* fails (and may have stopped before some of them): their text must */
+/* still be read, so it isn't run as commands.                       */
+/*------------------------------------------------------------------*/
+void alldocs(struct arena *a, char **w, int nw)
+{
+    struct redir r, *rp;
+    int i, len;
+
+    heredocs = NULL;
+    lastdoc = &heredocs;
+    for (i=0;i<nw;i++) {
+        len = isredir(w[i],&r);
+        if (len == 0 || r.type != R_HEREDOC)
+            continue;
+        r.word = w[i] + len;
+        if (*r.word == '\0') {      /* the TAG is the next word */
+            if (i+1 == nw)
+                break;
+            r.word = w[++i];
+        }
+        rp = aalloc(a,sizeof(struct redir));
+        *rp = r;
+        rp->next = NULL;
+        rp->nextdoc = NULL;
+        rp->text = NULL;
+        rp->len = 0;
+        *lastdoc = rp;
+        lastdoc = &rp->nextdoc;
+    }
+}
+
+/*------------------------------------------------------------------*/
+/* Return the first command of the line t.                          */
+/*------------------------------------------------------------------*/
+struct node *firstcmd(struct node *t)
+{
+    if (t->type != N_PIPE)
+        t = t->u.op.left;
+    return t->u.pipe.stage[0];
+}
+
+/*------------------------------------------------------------------*/
+/* Apply the redirections in the list r to fd, which holds the      */
+/* descriptors a command will get as its 0, 1 and 2. The files are  */
+/* opened (and here-documents put in memory files) by the shell,    */
+/* with O_CLOEXEC, so every launch engine can use them and nothing  */
+/* leaks into other commands. The descriptors opened are put in     */
+/* opened[*nopened] ...; the caller closes them once the command    */
+/* has started. opened must have room for nredir+3 descriptors.     */
+/*                                                                  */
+/* Finally any fd[i] (other than i) that is itself 0, 1 or 2 is     */
+/* replaced by a copy above 2, so the child can simply dup2 fd[i]   */
+/* to i for each i without one dup2 undoing another.                */
+/*                                                                  */
+/* Return 0 on success, or -1 (after displaying a message) if a     */
+/* file can't be opened.                                            */
+/*------------------------------------------------------------------*/
+int redirect(struct redir *r, int *fd, int *opened, int *nopened)
+{
+    int f, i;
+    size_t n;
+    ssize_t w;
+
+    for (;r!=NULL;r=r->next) {
+        switch (r->type) {
+        case R_IN:
+            f = open(r->word,O_RDONLY|O_CLOEXEC);
+            break;
+        case R_OUT:
+            f = open(r->word,O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC,0666);
+            break;
+        case R_APPEND:
+            f = open(r->word,O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC,0666);
+            break;
+        case R_DUP:
+            fd[r->fd] = fd[r->from];
+            continue;
+        default:            /* R_HEREDOC */
+            f = memfd_create("prog1-heredoc",MFD_CLOEXEC);
+            for (n=0;f!=-1 && n<r->len;n+=w) {
+                w = write(f,r->text+n,r->len-n);
+                if (w == -1) {
+                    close(f);
+                    f = -1;
+                }
+            }
+            if (f != -1)
+                lseek(f,0,SEEK_SET);
+            break;
+        }
+        if (f == -1) {
+            fprintf(stderr,"%s: %s\n", r->type == R_HEREDOC
+                    ? "here-document" : r->word, strerror(errno));
+            return -1;
+        }
+        opened[(*nopened)++] = f;
+        fd[r->fd] = f;
+    }
+
+    for (i=0;i<3;i++) {
+        if (fd[i] == i || fd[i] > 2)
+            continue;
+        f = fcntl(fd[i],F_DUPFD_CLOEXEC,3);
+        if (f == -1) {
+            perror("fcntl");
+            return -1;
+        }
+        opened[(*nopened)++] = f;
+        fd[i] = f;
+    }
+    return 0;
+}
+
+/*------------------------------------------------------------------*/
+/* With -e server, commands are started by a "fork server": a small */
+/* helper process created when the shell starts, before the shell   */
+/* has grown. For each command the shell sends the helper a request */
+/* on a socket: the program's path, its arguments and environment,  */
+/* and (with SCM_RIGHTS) the descriptors for its standard input,    */
+/* output and error and its current directory. The helper creates   */
+/* the process with clone(CLONE_PARENT), which makes it a child of  */
+/* the shell (so the shell waits for it as usual), and replies with */
+/* its process ID. Only the helper's small address space is copied, */
+/* so launching doesn't get slower as the shell uses more memory.   */
+/*------------------------------------------------------------------*/
+struct request {
+    size_t len;         /* # of bytes of strings that follow */
+    int argc;           /* # of arguments */
+    int envc;           /* # of environment strings */
+};
+
+#define NREQFD 4          /* descriptors sent: stdin, stdout, stderr, cwd */
+
+char *reqbuf;           /* strings for a request */
+size_t reqsize;         /* # of bytes allocated for reqbuf */
+
+/*------------------------------------------------------------------*/
+/* Read exactly n bytes from fd into buf. Return 0 on success, or   */
+/* -1 at end of file or on an error.                                */
+/*------------------------------------------------------------------*/
+int readall(int fd, void *buf, size_t n)
+{
+    ssize_t r;
+
+    while (n > 0) {
+        r = read(fd,buf,n);
+        if (r == -1 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return -1;
+        buf = (char *)buf + r;
+        n -= r;
+    }
+    return 0;
+}
+
+/*------------------------------------------------------------------*/
+/* The fork server. Serve requests from socket s until the shell    */
+/* closes it. The reply to each request is the new process's ID, or */
+/* minus the errno value if clone failed.                           */
+/*------------------------------------------------------------------*/
+void serve(int s)
+{
+    struct request rq;
+    struct msghdr mh;
+    struct iovec iov;
+    union {
+        char buf[CMSG_SPACE(NREQFD*sizeof(int))];
+        struct cmsghdr align;
+    } u;
+    struct cmsghdr *cm;
+    int fds[NREQFD];
+    char *buf, **av, *p;
+    size_t bufsize;
+    int avsize, k;
+    ssize_t n;
+    pid_t pid;
+
+    buf = NULL;
+    av = NULL;
+    bufsize = avsize = 0;
+    for (;;) {
+        memset(&mh,0,sizeof(mh));
+        iov.iov_base = &rq;
+        iov.iov_len = sizeof(rq);
+        mh.msg_iov = &iov;
+        mh.msg_iovlen = 1;
+        mh.msg_control = u.buf;
+        mh.msg_controllen = sizeof(u.buf);
+        n = recvmsg(s,&mh,MSG_WAITALL|MSG_CMSG_CLOEXEC);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n != sizeof(rq))
+            _exit(0);           /* the shell has ended */
+        cm = CMSG_FIRSTHDR(&mh);
+        if (cm == NULL || cm->cmsg_type != SCM_RIGHTS
+                || cm->cmsg_len != CMSG_LEN(NREQFD*sizeof(int)))
+            _exit(1);
+        memcpy(fds,CMSG_DATA(cm),sizeof(fds));
+
+        if (rq.len > bufsize) {
+            bufsize = rq.len;
+            buf = realloc(buf,bufsize);
+        }
+        if (rq.argc + rq.envc + 2 > avsize) {
+            avsize = rq.argc + rq.envc + 2;
+            av = realloc(av,avsize*sizeof(char *));
+        }
+        if (buf == NULL || av == NULL || readall(s,buf,rq.len) == -1)
+            _exit(1);
+
+        /* buf holds the path, then the arguments, then the environment. */
+        p = buf + strlen(buf) + 1;
+        for (k=0;k<rq.argc+rq.envc+1;k++) {
+            if (k == rq.argc) {
+                av[k] = NULL;       /* end of the arguments */
+                continue;
+            }
+            av[k] = p;
+            p += strlen(p) + 1;
+        }
+        av[k] = NULL;           /* end of the environment */
+
+        pid = syscall(SYS_clone,CLONE_PARENT|SIGCHLD,NULL,NULL,NULL,NULL);
+        if (pid == 0) {
+            dup2(fds[0],0);
+            dup2(fds[1],1);
+            dup2(fds[2],2);
+            fchdir(fds[3]);
+            execve(buf,av,av+rq.argc+1);
+            perror("execve");
+            _exit(0);
+        }
+        if (pid == -1)
+            pid = -errno;
+        for (k=0;k<NREQFD;k++)
+            close(fds[k]);
+        write(s,&pid,sizeof(pid));
+    }
+}
+
+/*------------------------------------------------------------------*/
+/* Start the fork server. If it can't be started, display a message */
+/* and use fork instead.                                            */
+/*------------------------------------------------------------------*/
+void startserver(void)
+{
+    int sv[2], fd;
+    pid_t pid;
+
+    if (socketpair(AF_UNIX,SOCK_STREAM|SOCK_CLOEXEC,0,sv) == -1) {
+        perror("fork server: socketpair");
+        engine = E_FORK;
+        return;
+    }
+    pid = fork();
+    if (pid == -1) {
+        perror("fork server: fork");
+        close(sv[0]);
+        close(sv[1]);
+        engine = E_FORK;
+        return;
+    }
+    if (pid == 0) {
+        /* Keep nothing of the shell's but the socket. */
+        fd = open("/dev/null",O_RDWR);
+        if (fd != -1) {
+            dup2(fd,0);
+            dup2(fd,1);
+            close(fd);
+        }
+        if (sv[1] != 3)
+            dup3(sv[1],3,O_CLOEXEC);
+        close_range(4,~0U,0);
+        serve(3);
+    }
+    close(sv[1]);
+    server = sv[0];
+}
+
+/*------------------------------------------------------------------*/
+/* Ask the fork server to start the program in 'file' (see launch). */
+/* Return the new process's ID, or -1 if the server couldn't do it  */
+/* (it is then not used again).                                     */
+/*------------------------------------------------------------------*/
+pid_t srvlaunch(char *file, char *cmd[], char *env[], int *fd)
+{
+    struct request rq;
+    struct msghdr mh;
+    struct iovec iov[2];
+    union {
+        char buf[CMSG_SPACE(NREQFD*sizeof(int))];
+        struct cmsghdr align;
+    } u;
+    struct cmsghdr *cm;
+    int fds[NREQFD];
+    size_t len, n;
+    ssize_t r;
+    char **v, *p;
+    pid_t pid;
+
+    if (cwdfd == -1)
+        cwdfd = open(".",O_PATH|O_DIRECTORY|O_CLOEXEC);
+    if (cwdfd == -1)
+        return -1;          /* fork can still run it */
+
+    /*-------------------------------------------------------*/
+    /* Put the path, arguments and environment in reqbuf.    */
+    /*-------------------------------------------------------*/
+    rq.argc = rq.envc = 0;
+    len = strlen(file) + 1;
+    for (v=cmd;*v!=NULL;v++,rq.argc++)
+        len += strlen(*v) + 1;
+    for (v=env;*v!=NULL;v++,rq.envc++)
+        len += strlen(*v) + 1;
+    if (len > reqsize) {
+        free(reqbuf);
+        reqsize = 2 * len;
+        reqbuf = malloc(reqsize);
+        if (reqbuf == NULL) {
+            write(2,"*** ERROR: Out of memory.\n",26);
+            exit(1);
+        }
+    }
+    p = stpcpy(reqbuf,file) + 1;
+    for (v=cmd;*v!=NULL;v++)
+        p = stpcpy(p,*v) + 1;
+    for (v=env;*v!=NULL;v++)
+        p = stpcpy(p,*v) + 1;
+    rq.len = len;
+
+    fds[0] = fd[0];
+    fds[1] = fd[1];
+    fds[2] = fd[2];
+    fds[3] = cwdfd;
+
+    memset(&mh,0,sizeof(mh));
+    memset(&u,0,sizeof(u));
+    iov[0].iov_base = &rq;
+    iov[0].iov_len = sizeof(rq);
+    iov[1].iov_base = reqbuf;
+    iov[1].iov_len = len;
+    mh.msg_iov = iov;
+    mh.msg_iovlen = 2;
+    mh.msg_control = u.buf;
+    mh.msg_controllen = sizeof(u.buf);
+    cm = CMSG_FIRSTHDR(&mh);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(NREQFD*sizeof(int));
+    memcpy(CMSG_DATA(cm),fds,sizeof(fds));
+
+    /*-------------------------------------------------------*/
+    /* Send the request (the rest of a long one with send:   */
+    /* first what's left of the header, then of reqbuf), and */
+    /* get the reply.                                        */
+    /*-------------------------------------------------------*/
+    r = sendmsg(server,&mh,MSG_NOSIGNAL);
+    n = r > 0 ? r : 0;
+    while (r != -1 && n < sizeof(rq) + len) {
+        if (n < sizeof(rq))
+            r = send(server,(char *)&rq+n,sizeof(rq)-n,MSG_NOSIGNAL);
+        else
+            r = send(server,reqbuf+(n-sizeof(rq)),sizeof(rq)+len-n,
+                     MSG_NOSIGNAL);
+        if (r > 0)
+            n += r;
+    }
+    if (r == -1 || readall(server,&pid,sizeof(pid)) == -1) {
+        perror("fork server");
+        close(server);
+        server = -1;
+        return -1;
+    }
+    if (pid < 0) {
+        errno = -pid;
+        perror("fork");
+        exit(1);
+    }
+    return pid;
+}
+
+/*-------------------------------------------------------------------*/
+/* Start a child process running the program in 'file', with the     */
+/* arguments in cmd and the environment env. fd[i] (for i = 0, 1,  */
+/* 2) becomes the child's descriptor i (see 'redirect').             */
+/* Return the child's process ID, or 0 if the program couldn't be    */
+/* executed (in which case *status is set as if the child had ended). */
+/*-------------------------------------------------------------------*/
+/* With the fork engine, the whole shell is duplicated and the child */
+/* then replaces itself with the program. posix_spawn (which in      */
+/* glibc uses a vfork-style clone that shares the shell's memory     */
+/* until execve) avoids copying the shell's page tables, so its cost */
+/* doesn't grow as the shell does. The fork server (-e server) gets  */
+/* the same effect by forking a process that stays small.            */
+/*-------------------------------------------------------------------*/
+/* All other descriptors the shell has open for a pipeline are       */
+/* created with O_CLOEXEC, so they disappear when the child execs.   */
+/*-------------------------------------------------------------------*/
+pid_t launch(char *file, char *cmd[], char *env[], int *fd, int *status)
+{
+    pid_t pid;
+    int err, i;
+    posix_spawn_file_actions_t fa;
+
+    syncinput();                /* child must see unread input */
+
+    /* The server's processes are children of the shell itself,  */
+    /* not of a line process or forked builtin.                  */
+    if (engine == E_SERVER && server != -1 && !subshell) {
+        pid = srvlaunch(file,cmd,env,fd);
+        if (pid != -1)
+            return pid;
+    }
+
+    if (engine == E_SPAWN) {
+        posix_spawn_file_actions_init(&fa);
+        for (i=0;i<3;i++)
+            if (fd[i] != i)
+                posix_spawn_file_actions_adddup2(&fa,fd[i],i);
+        err = posix_spawn(&pid,file,&fa,NULL,cmd,env);
+        posix_spawn_file_actions_destroy(&fa);
+        if (err != 0) {
+            fprintf(stderr,"execve: %s\n", strerror(err));
+            *status = 0;            /* as with a failed execve */
+            return 0;
+        }
+        return pid;
+    }
+
+    pid = fork();               /* create a new process */
+
+    if (pid == -1) {            /* verify fork succeeded */
+        perror("fork");
+        exit(1);
+    } else if (pid == 0) {
+        for (i=0;i<3;i++)
+            if (fd[i] != i)
+                dup2(fd[i],i);
+        execve(file,cmd,env);       /* try to execute it */
+
+        perror("execve");           /* we only get here if */
+        exit(0);                /* execve failed... */
+    }
+    return pid;
+}
+
+/*-------------------------------------------------------------------*/
+/* Run builtin b (with arguments cmd) in a child process, as is done */
+/* for a builtin that's one stage of a pipeline. fd is as for        */
+/* launch. The child never execs, so it closes every other       */
+/* descriptor itself; otherwise it could keep a pipe open that       */
+/* another stage is waiting to see closed. Return the child's        */
+/* process ID.                                                       */
+/*-------------------------------------------------------------------*/
+pid_t forkbuiltin(struct builtin *b, char *cmd[], int *fd)
+{
+    pid_t pid;
+    int argc, i;
+
+    syncinput();
+    pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        exit(1);
+    } else if (pid == 0) {
+        subshell = 1;
+        statfd = -1;
+        for (i=0;i<3;i++)
+            if (fd[i] != i)
+                dup2(fd[i],i);
+        close_range(3,~0U,0);
+        for (argc=0;cmd[argc]!=NULL;argc++)
+            ;
+        exit(b->func(argc,cmd));
+    }
+    return pid;
+}
+
+/*--------------------------------------------------------------------*/
+/* In relay mode (-R), the stages of a pipeline aren't connected      */
+/* directly. Instead each stage writes to a pipe read by the shell,   */
+/* and the shell moves the data to a second pipe read by the next     */
+/* stage. The data is moved with splice, so it is never copied into  */
+/* (or out of) the shell's memory.                                    */
+/*                                                                    */
+/* There are nl links. The shell reads link i from rfd[i] and writes  */
+/* it to wfd[i]. A link ends (and both descriptors are closed) when   */
+/* rfd[i] reaches end of file, or when nothing is left to read wfd[i]. */
+/*--------------------------------------------------------------------*/
+void relay(int nl, int *rfd, int *wfd)
+{
+    struct pollfd pfd[nl];
+    int full[nl];       /* non-zero if link i waits for wfd[i] */
+    int i, active;
+    ssize_t n;
+    void (*oldpipe)(int);
+
+    oldpipe = signal(SIGPIPE,SIG_IGN);  /* get EPIPE instead */
+    for (i=0;i<nl;i++) {
+        fcntl(rfd[i],F_SETFL,O_NONBLOCK);
+        fcntl(wfd[i],F_SETFL,O_NONBLOCK);
+        full[i] = 0;
+    }
+
+    for (active=nl;active>0;) {
+        for (i=0;i<nl;i++) {
+            if (rfd[i] == -1)
+                pfd[i].fd = -1;     /* poll ignores this entry */
+            else if (full[i]) {
+                pfd[i].fd = wfd[i];
+                pfd[i].events = POLLOUT;
+            } else {
+                pfd[i].fd = rfd[i];
+                pfd[i].events = POLLIN;
+            }
+        }
+        if (poll(pfd,nl,-1) == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            exit(1);
+        }
+
+        for (i=0;i<nl;i++) {
+            if (pfd[i].fd == -1 || pfd[i].revents == 0)
+                continue;
+            n = splice(rfd[i],NULL,wfd[i],NULL,RELAYSIZE,
+                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n > 0) {
+                full[i] = 0;
+                continue;
+            }
+            if (n == -1 && errno == EAGAIN) {
+                /* Either no input yet, or the next stage is behind. */
+                full[i] = !full[i] && (pfd[i].revents & POLLIN) != 0;
+                continue;
+            }
+            close(rfd[i]);          /* end of file or EPIPE */
+            close(wfd[i]);
+            rfd[i] = wfd[i] = -1;
+            active--;
+        }
+    }
+    signal(SIGPIPE,oldpipe);
+}
+
+/*------------------------------------------------------------------*/
+/* Return the environment for the command c: the exported variables */
+/* with c's assignments (the NAME=value words before the command)   */
+/* added or replacing them. Without assignments, that is just the   */
+/* cached envp; otherwise a new array is allocated from xarena.     */
+/*------------------------------------------------------------------*/
+char **cmdenv(struct node *c)
+{
+    char **e, **env;
+    int i, k, n;
+    size_t len;
+
+    e = getenvp();
+    if (c->u.cmd.nassign == 0)
+        return e;
+    for (n=0;e[n]!=NULL;n++)
+        ;
+    env = aalloc(&xarena,(n+c->u.cmd.nassign+1)*sizeof(char *));
+    for (k=0;k<c->u.cmd.nassign;k++)
+        env[k] = c->u.cmd.assign[k];
+    for (;*e!=NULL;e++) {
+        len = strchr(*e,'=') - *e + 1;
+        for (i=0;i<c->u.cmd.nassign;i++)
+            if (!strncmp(*e,c->u.cmd.assign[i],len))
+                break;              /* replaced */
+        if (i == c->u.cmd.nassign)
+            env[k++] = *e;
+    }
+    env[k] = NULL;
+    return env;
+}
+
+/*--------------------------------------------------------------------*/
+/* Run the pipeline pl (an N_PIPE node). All of its commands run      */
+/* concurrently, with the standard output of each connected to the    */
+/* standard input of the next by a pipe. The status of the pipeline   */
+/* (in *status) is that of the last command.                          */
+/*                                                                    */
+/* If bg is non-zero, the pipeline is a background job: it is added  */
+/* to the job table and not waited for, and *status is set to 0. If   */
+/* the input isn't from a terminal, the job's standard input is       */
+/* /dev/null, so it can't consume the rest of the shell's input. Its  */
+/* stages are connected directly even with -R, since the relay would  */
+/* keep the shell busy until the job finished.                        */
+/*                                                                    */
+/* The times and sizes of a foreground pipeline's processes are put  */
+/* in *cs (see 'account').                                            */
+/*                                                                    */
+/* If any command cannot be executed, display a message and return    */
+/* -1 without running any of them. Otherwise return 0.                */
+/*--------------------------------------------------------------------*/
+int pipeline(struct node *pl, int bg, int *status, struct cstat *cs)
+{
+    int ns = pl->u.pipe.ns;     /* # of commands */
+    char *ppath[ns];            /* path to each command */
+    pid_t pid[ns];          /* process ID of each command */
+    int rfd[ns], wfd[ns];       /* relay descriptors */
+    int nl;             /* # of relay links */
+    int fd[2];
+    int cfd[3];             /* descriptors 0, 1, 2 for a command */
+    int nopened;            /* # of descriptors opened by redirect */
+    int in, out, nextin, i, k, st;
+    struct timespec t0, t1, t2;
+    struct rusage ru;
+    struct node *c;
+
+    for (k=0;k<ns;k++) {
+        ppath[k] = NULL;
+        c = pl->u.pipe.stage[k];
+        if (c->u.cmd.b != NULL)
+            continue;
+        if (execok(c->u.cmd.argv[0]) != 0) {
+            fprintf(stderr,"*** ERROR: '%s' cannot be executed.\n",
+                    c->u.cmd.argv[0]);
+            while (--k >= 0)
+                free(ppath[k]);
+            return -1;
+        }
+        ppath[k] = strdup(path);
+        if (ppath[k] == NULL) {
+            write(2,"*** ERROR: Out of memory.\n",26);
+            exit(1);
+        }
+    }
+
+    nl = 0;
+    in = -1;
+    st = 0;
+    if (bg && !isterm)
+        in = open("/dev/null",O_RDONLY|O_CLOEXEC);
+    clock_gettime(CLOCK_MONOTONIC,&t0);
+    for (k=0;k<ns;k++) {
+        out = nextin = -1;
+        if (k < ns-1) {
+            if (pipe2(fd,O_CLOEXEC) == -1) {
+                perror("pipe");
+                exit(1);
+            }
+            out = fd[1];
+            nextin = fd[0];
+            if (relaymode && !bg) { /* shell sits between stages */
+                rfd[nl] = fd[0];
+                if (pipe2(fd,O_CLOEXEC) == -1) {
+                    perror("pipe");
+                    exit(1);
+                }
+                wfd[nl++] = fd[1];
+                nextin = fd[0];
+            }
+        }
+
+        clock_gettime(CLOCK_MONOTONIC,&t1);
+        c = pl->u.pipe.stage[k];
+        int opened[c->u.cmd.nredir+3];
+        cfd[0] = in != -1 ? in : 0;
+        cfd[1] = out != -1 ? out : 1;
+        cfd[2] = 2;
+        nopened = 0;
+        if (redirect(c->u.cmd.redir,cfd,opened,&nopened) == -1) {
+            pid[k] = 0;         /* not started */
+            st = 1 << 8;
+        } else if (c->u.cmd.b != NULL)
+            pid[k] = forkbuiltin(c->u.cmd.b,c->u.cmd.argv,cfd);
+        else
+            pid[k] = launch(ppath[k],c->u.cmd.argv,cmdenv(c),cfd,&st);
+        clock_gettime(CLOCK_MONOTONIC,&t2);
+        cs->spawn += elapsed(&t1,&t2);
+
+        for (i=0;i<nopened;i++)
+            close(opened[i]);
+        free(ppath[k]);
+        if (in != -1)
+            close(in);
+        if (out != -1)
+            close(out);
+        in = nextin;
+    }
+
+    if (nl > 0)
+        relay(nl,rfd,wfd);
+
+    if (bg) {
+        k = addjob(ns,pid,pl);
+        if (k != 0 && isterm)
+            printf("[%d] %d\n", k, (int)pid[ns-1]);
+        *status = 0;
+        return 0;
+    }
+
+    *status = st;
+    for (k=0;k<ns;k++) {
+        if (pid[k] == 0)        /* never started */
+            continue;
+        if (wait4(pid[k],&st,0,&ru) == -1) {
+            write(2,"Wait failed.\n",13);
+            exit(1);
+        }
+        addusage(cs,&ru);
+        if (k == ns-1)
+            *status = st;
+    }
+    clock_gettime(CLOCK_MONOTONIC,&t2);
+    cs->real = elapsed(&t0,&t2);
+    return 0;
+}
+
+/*------------------------------------------------------------------*/
+/* Expansions. In a word, "$NAME" or "${NAME}" is replaced by the   */
+/* value of the variable NAME (nothing if it isn't set), and "$?"   */
+/* by the exit status of the last pipeline.                         */
+/*                                                                  */
+/* Command substitution: "$(cmd)" is replaced by the output of cmd, */
+/* which is run by a copy of the shell with its standard output     */
+/* going to a pipe. The output is captured in a buffer that grows   */
+/* as needed, up to SUBSTMAX bytes; if cmd writes more it is        */
+/* killed, and the pipeline isn't run. Trailing newlines are        */
+/* removed.                                                         */
+/*                                                                  */
+/* The results of expansions in command arguments are split into    */
+/* separate words at spaces, tabs and newlines. In NAME=value words */
+/* they are not.                                                    */
+/*                                                                  */
+/* All the substitutions in a pipeline are started before any of    */
+/* their output is read, so they run at the same time as each other */
+/* and as the shell, which goes on finding and starting the rest.   */
+/* The expanded pipeline is allocated from xarena, and released     */
+/* once it has run.                                                 */
+/*------------------------------------------------------------------*/
+struct subst {
+    pid_t pid;          /* process running the command */
+    int fd;         /* pipe its output is read from */
+    char *buf;          /* its output */
+    size_t len;         /* # of bytes in buf */
+    size_t size;        /* # of bytes allocated for buf */
+};
+
+int execute(struct node *t);        /* defined below */
+
+/*------------------------------------------------------------------*/
+/* Find the first expansion in the string p: "$(...)", "$NAME",     */
+/* "${NAME}" or "$?". Return a pointer to its "$" and set *e to     */
+/* just after it, or return NULL if there is none. A "$" that isn't */
+/* the start of an expansion is left as it is.                      */
+/*------------------------------------------------------------------*/
+char *findexp(char *p, char **e)
+{
+    int depth;          /* # of unclosed parentheses */
+    int n;
+    char *q;
+
+    for (;(p=strchr(p,'$'))!=NULL;p++) {
+        if (p[1] == '(') {
+            depth = 1;
+            for (q=p+2;*q!='\0' && depth>0;q++) {
+                if (*q == '(')
+                    depth++;
+                else if (*q == ')')
+                    depth--;
+            }
+            *e = q;
+            return p;
+        }
+        if (p[1] == '?') {
+            *e = p + 2;
+            return p;
+        }
+        if ((n = namelen(p+1)) > 0) {
+            *e = p + 1 + n;
+            return p;
+        }
+        if (p[1] == '{' && (n = namelen(p+2)) > 0 && p[n+2] == '}') {
+            *e = p + n + 3;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+/*------------------------------------------------------------------*/
+/* Return the value of the variable expansion from b to e (see      */
+/* findexp), or "" if the variable isn't set. buf is used for "$?". */
+/*------------------------------------------------------------------*/
+char *varvalue(char *b, char *e, char *buf)
+{
+    struct var *v;
+
+    if (b[1] == '?') {
+        sprintf(buf,"%d", laststatus);
+        return buf;
+    }
+    if (b[1] == '{')
+        v = findvar(b+2,e-b-3);
+    else
+        v = findvar(b+1,e-b-1);
+    return v->str != NULL ? v->str + v->nlen + 1 : "";
+}
+
+/*------------------------------------------------------------------*/
+/* Start a copy of the shell running the n chars of command text at */
+/* p, with its standard output going to a pipe, and fill in *sp.    */
+/*------------------------------------------------------------------*/
+void startsubst(char *p, size_t n, struct subst *sp)
+{
+    int fd[2], st;
+    char *text;
+    struct node *t;
+
+    if (pipe2(fd,O_CLOEXEC) == -1) {
+        perror("pipe");
+        exit(1);
+    }
+    syncinput();
+    fflush(stdout);
+    sp->pid = fork();
+    if (sp->pid == -1) {
+        perror("fork");
+        exit(1);
+    }
+    if (sp->pid == 0) {
+        dup2(fd[1],1);
+        subshell = 1;
+        ebuflen = 0;            /* the shell writes the echo */
+        memset(jobs,0,sizeof(jobs));
+        njobs = pqlen = nrunning = maxpar = 0;
+        text = aalloc(&linearena,n+1);
+        memcpy(text,p,n);
+        text[n] = '\0';
+        st = 0;
+        if (lex(&linearena,text)) {
+            t = parse(&linearena,words,nwds);
+            if (t != NULL)
+                st = execute(t);
+        }
+        fflush(stdout);
+        fflush(stderr);
+        _exit(exitstatus(st));
+    }
+    close(fd[1]);
+    sp->fd = fd[0];
+    sp->buf = NULL;
+    sp->len = sp->size = 0;
+}
+
+/*------------------------------------------------------------------*/
+/* Read the output of the n substitutions in s, whichever is ready, */
+/* until they all end, and wait for their processes. Return 0, or   */
+/* -1 if one wrote more than SUBSTMAX bytes (a message is shown).   */
+/*------------------------------------------------------------------*/
+int readsubst(struct subst *s, int n)
+{
+    struct pollfd pfd[n];
+    int i, active, err;
+    ssize_t r;
+
+    for (i=0;i<n;i++) {
+        pfd[i].fd = s[i].fd;
+        pfd[i].events = POLLIN;
+    }
+    err = 0;
+    for (active=n;active>0;) {
+        if (poll(pfd,n,-1) == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            exit(1);
+        }
+        for (i=0;i<n;i++) {
+            if (pfd[i].fd == -1 || pfd[i].revents == 0)
+                continue;
+            if (s[i].len > SUBSTMAX) {      /* too much: give up */
+                write(2,"*** ERROR: Output of $(...) is too long.\n",41);
+                kill(s[i].pid,SIGKILL);
+                err = -1;
+            } else {
+                if (s[i].len == s[i].size) {    /* buffer is full */
+                    s[i].size = s[i].size > 0 ? 2 * s[i].size : LINESIZE;
+                    if (s[i].size > SUBSTMAX)
+                        s[i].size = SUBSTMAX + 1;
+                    s[i].buf = realloc(s[i].buf,s[i].size);
+                    if (s[i].buf == NULL) {
+                        write(2,"*** ERROR: Out of memory.\n",26);
+                        exit(1);
+                    }
+                }
+                r = read(pfd[i].fd,s[i].buf+s[i].len,s[i].size-s[i].len);
+                if (r > 0) {
+                    s[i].len += r;
+                    continue;
+                }
+                if (r == -1 && errno == EINTR)
+                    continue;
+            }
+            close(pfd[i].fd);
+            pfd[i].fd = -1;
+            active--;
+        }
+    }
+    for (i=0;i<n;i++)
+        waitpid(s[i].pid,NULL,0);
+    return err;
+}
+
+/*------------------------------------------------------------------*/
+/* Put in xarena the word w with its expansions done, taking the    */
+/* output of its command substitutions from s[*n], s[*n+1], ...     */
+/* (and advancing *n). If split is non-zero, the results are split  */
+/* into fields at whitespace; the fields are stored one after       */
+/* another, each null-terminated, and their number is put in *nf.   */
+/* Otherwise the result is one field.                               */
+/*------------------------------------------------------------------*/
+char *expandword(char *w, struct subst *s, int *n, int split, int *nf)
+{
+    char *buf, *q, *p, *b, *e, *v;
+    char num[16];           /* value of $? */
+    size_t size, len, i;
+    int m, inword;
+
+    size = strlen(w) + 1;
+    for (m=*n,p=w;(b=findexp(p,&e))!=NULL;p=e)
+        size += (b[1] == '(' ? s[m++].len : strlen(varvalue(b,e,num))) + 1;
+    buf = q = aalloc(&xarena,size);
+    *nf = 0;
+    inword = 0;
+    for (p=w;;p=e) {
+        b = findexp(p,&e);
+        len = b != NULL ? (size_t)(b - p) : strlen(p);
+        memcpy(q,p,len);        /* the text before the "$" */
+        q += len;
+        inword |= len > 0;
+        if (b == NULL)
+            break;
+
+        if (b[1] == '(') {
+            v = s[*n].buf;
+            len = s[*n].len;
+            while (len > 0 && v[len-1] == '\n')
+                len--;
+            (*n)++;
+        } else {
+            v = varvalue(b,e,num);
+            len = strlen(v);
+        }
+        for (i=0;i<len;i++) {
+            if (!split || strchr(" \t\n",v[i]) == NULL) {
+                *q++ = v[i];
+                inword = 1;
+            } else if (inword) {    /* end of a field */
+                *q++ = '\0';
+                (*nf)++;
+                inword = 0;
+            }
+        }
+    }
+    if (inword || !split) {
+        *q = '\0';
+        (*nf)++;
+    }
+    return buf;
+}
+
+/*------------------------------------------------------------------*/
+/* Expand the n words in w (see expandword) and return the results  */
+/* as a NULL-terminated array allocated from xarena, with the # of  */
+/* words in *nw.                                                    */
+/*------------------------------------------------------------------*/
+char **expandwords(char **w, int n, struct subst *s, int *k, int split,
+                   int *nw)
+{
+    char *text[n];          /* fields of each word */
+    int count[n];           /* # of fields of each word */
+    char **v, *p;
+    int i, j, nf;
+
+    nf = 0;
+    for (i=0;i<n;i++) {
+        text[i] = expandword(w[i],s,k,split,&count[i]);
+        nf += count[i];
+    }
+    v = aalloc(&xarena,(nf+1)*sizeof(char *));
+    nf = 0;
+    for (i=0;i<n;i++)
+        for (p=text[i],j=0;j<count[i];j++,p+=strlen(p)+1)
+            v[nf++] = p;
+    v[nf] = NULL;
+    *nw = nf;
+    return v;
+}
+
+/*------------------------------------------------------------------*/
+/* Pathname expansion. A command argument containing *, ? or [ is a */
+/* pattern, and is replaced by the paths of the existing files it   */
+/* matches, sorted (by strcmp, the C locale's order) and without    */
+/* duplicates; if there are none, it is left as it is. The pattern  */
+/* is matched one path component at a time with fnmatch; names     */
+/* starting with "." are only matched by a component that starts    */
+/* with ".", and "." and ".." are never matched by a pattern.       */
+/*                                                                  */
+/* The names in each directory searched are kept in a cache, along  */
+/* with the directory's device, inode and modification time. A      */
+/* later search of the same directory (by any path) costs just a    */
+/* stat, unless the directory has changed, in which case it is read */
+/* again. A directory modified in the second it was read may change */
+/* again without a new mtime, so its names are only used once.      */
+/*------------------------------------------------------------------*/
+struct dircache {
+    struct dircache *next;  /* next entry in the same bucket */
+    dev_t dev;          /* the directory's device */
+    ino_t ino;          /* and inode */
+    struct timespec mtime;  /* its modification time when read */
+    int racy;           /* non-zero if modified in the second read */
+    int n;          /* # of names */
+    char **names;       /* the names, sorted */
+    char *text;         /* storage for the names */
+} *dirtab[NDHASH];
+
+int ndirs;              /* # of directories in dirtab */
+
+/*---------------------------------------------*/
+/* Compare two names for qsort, using strcmp.   */
+/*---------------------------------------------*/
+int namecmp(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a,*(char * const *)b);
+}
+
+/*-----------------------------------------------*/
+/* Free the cache entry d.                       */
+/*-----------------------------------------------*/
+void dirfree(struct dircache *d)
+{
+    free(d->names);
+    free(d->text);
+    free(d);
+}
+
+/*----------------------------------------------------------------*/
+/* Read the names in the open directory dp into a new cache entry */
+/* for the directory described by sb. Return NULL on failure.     */
+/*----------------------------------------------------------------*/
+struct dircache *dirread(DIR *dp, struct stat *sb)
+{
+    struct dircache *d;
+    struct dirent *de;
+    struct timespec now;
+    size_t len, size, n;
+    char *p;
+    int i;
+
+    d = calloc(1,sizeof(struct dircache));
+    if (d == NULL)
+        return NULL;
+    d->dev = sb->st_dev;
+    d->ino = sb->st_ino;
+    d->mtime = sb->st_mtim;
+    clock_gettime(CLOCK_REALTIME,&now);
+    d->racy = now.tv_sec <= sb->st_mtim.tv_sec;
+
+    len = size = 0;
+    while ((de = readdir(dp)) != NULL) {
+        if (!strcmp(de->d_name,".") || !strcmp(de->d_name,".."))
+            continue;
+        n = strlen(de->d_name) + 1;
+        if (len + n > size) {
+            size = size > 0 ? 2 * size : 4096;
+            if (size < len + n)
+                size = len + n;
+            p = realloc(d->text,size);
+            if (p == NULL) {
+                dirfree(d);
+                return NULL;
+            }
+            d->text = p;
+        }
+        memcpy(d->text+len,de->d_name,n);
+        len += n;
+        d->n++;
+    }
+
+    d->names = malloc((d->n+1)*sizeof(char *));
+    if (d->names == NULL) {
+        dirfree(d);
+        return NULL;
+    }
+    for (p=d->text,i=0;i<d->n;i++,p+=strlen(p)+1)
+        d->names[i] = p;
+    qsort(d->names,d->n,sizeof(char *),namecmp);
+    return d;
+}
+
+/*-----------------------------------------------*/
+/* Remove (and free) every entry in the cache.   */
+/*-----------------------------------------------*/
+void dirflush(void)
+{
+    int i;
+    struct dircache *d, *next;
+
+    for (i=0;i<NDHASH;i++) {
+        for (d=dirtab[i];d!=NULL;d=next) {
+            next = d->next;
+            dirfree(d);
+        }
+        dirtab[i] = NULL;
+    }
+    ndirs = 0;
+}
 
-                perror("execve");           /* we only get here if */
-                exit(0);                /* execve failed... */
-            } else {
-                which = wait(&status);              /* wait for process to end */
+/*-------------------------------------------------------------------*/
+/* Return the cache entry with the names in the directory dir ("" is */
+/* the current directory), reading it if it isn't cached or the      */
+/* cached names are out of date. Return NULL if dir can't be read.   */
+/*-------------------------------------------------------------------*/
+struct dircache *getdir(char *dir)
+{
+    struct dircache *d, **dp;
+    struct stat sb;
+    DIR *dirp;
+    unsigned b;
 
-                if (which == -1) {
-                    write(2,"Wait failed.\n",12);
-                    exit(1);
+    if (*dir == '\0')
+        dir = ".";
+    if (stat(dir,&sb) == -1 || !S_ISDIR(sb.st_mode))
+        return NULL;
+
+    b = (unsigned)(sb.st_dev * 31 + sb.st_ino) % NDHASH;
+    for (dp=&dirtab[b];(d=*dp)!=NULL;dp=&d->next) {
+        if (d->dev != sb.st_dev || d->ino != sb.st_ino)
+            continue;
+        if (!d->racy && d->mtime.tv_sec == sb.st_mtim.tv_sec
+                && d->mtime.tv_nsec == sb.st_mtim.tv_nsec)
+            return d;
+        *dp = d->next;          /* out of date; discard */
+        dirfree(d);
+        ndirs--;
+        break;
+    }
+
+    dirp = opendir(dir);
+    if (dirp == NULL)
+        return NULL;
+    if (fstat(dirfd(dirp),&sb) == -1) {     /* what we actually read */
+        closedir(dirp);
+        return NULL;
+    }
+    d = dirread(dirp,&sb);
+    closedir(dirp);
+    if (d == NULL)
+        return NULL;
+
+    if (ndirs >= NDIRS)         /* cache full: start over */
+        dirflush();
+    b = (unsigned)(d->dev * 31 + d->ino) % NDHASH;
+    d->next = dirtab[b];
+    dirtab[b] = d;
+    ndirs++;
+    return d;
+}
+
+/*------------------------------------------------------------------*/
+/* Paths matching a pattern, collected by globpath.                 */
+/*------------------------------------------------------------------*/
+struct globres {
+    char **v;           /* the paths (allocated from xarena) */
+    int n;          /* # of paths */
+    int size;           /* # of entries allocated for v */
+};
+
+/*------------------------------------------------------------------*/
+/* Add to g the existing paths that are prefix (the first plen      */
+/* chars of which are an existing directory path, ending with "/",  */
+/* or empty) followed by a path that matches the pattern pat.       */
+/*------------------------------------------------------------------*/
+void globpath(char *prefix, size_t plen, char *pat, struct globres *g)
+{
+    struct dircache *d;
+    struct stat sb;
+    char *e, *r, *p, **v;
+    size_t clen, slen, n;
+    int i;
+
+    for (e=pat;*e!='\0' && *e!='/';e++)
+        ;
+    clen = e - pat;             /* the component is pat[0..clen) */
+    for (r=e;*r=='/';r++)
+        ;
+    slen = r - e;               /* followed by slen slashes */
+    char comp[clen+1];
+    memcpy(comp,pat,clen);
+    comp[clen] = '\0';
+
+    if (strpbrk(comp,"*?[") == NULL) {      /* no pattern: just add it */
+        p = aalloc(&xarena,plen+clen+slen+1);
+        memcpy(p,prefix,plen);
+        memcpy(p+plen,pat,clen+slen);
+        p[plen+clen+slen] = '\0';
+        if (*r != '\0')
+            globpath(p,plen+clen+slen,r,g);
+        else if (lstat(p,&sb) == 0) {
+            if (g->n == g->size) {
+                g->size = g->size > 0 ? 2 * g->size : 16;
+                v = aalloc(&xarena,g->size*sizeof(char *));
+                memcpy(v,g->v,g->n*sizeof(char *));
+                g->v = v;
+            }
+            g->v[g->n++] = p;
+        }
+        return;
+    }
+
+    char dir[plen+1];
+    memcpy(dir,prefix,plen);
+    dir[plen] = '\0';
+    d = getdir(dir);
+    if (d == NULL)
+        return;
+    for (i=0;i<d->n;i++) {
+        if (fnmatch(comp,d->names[i],FNM_PERIOD) != 0)
+            continue;
+        n = strlen(d->names[i]);
+        p = aalloc(&xarena,plen+n+slen+1);
+        memcpy(p,prefix,plen);
+        memcpy(p+plen,d->names[i],n);
+        memcpy(p+plen+n,e,slen);
+        p[plen+n+slen] = '\0';
+        globpath(p,plen+n+slen,r,g);    /* "" checks p exists */
+    }
+}
+
+/*------------------------------------------------------------------*/
+/* Do pathname expansion on the n words in w, and return the        */
+/* resulting words as a NULL-terminated array allocated from        */
+/* xarena, with the # of words in *nw.                              */
+/*------------------------------------------------------------------*/
+char **globwords(char **w, int n, int *nw)
+{
+    struct globres g[n];        /* matches for each word */
+    char **v, *p;
+    int i, j, k, nv;
+
+    nv = 0;
+    for (i=0;i<n;i++) {
+        memset(&g[i],0,sizeof(struct globres));
+        if (strpbrk(w[i],"*?[") != NULL) {
+            for (p=w[i];*p=='/';p++)
+                ;
+            globpath(w[i],p-w[i],p,&g[i]);
+            qsort(g[i].v,g[i].n,sizeof(char *),namecmp);
+            for (j=k=0;j<g[i].n;j++)    /* remove duplicates */
+                if (k == 0 || strcmp(g[i].v[k-1],g[i].v[j]) != 0)
+                    g[i].v[k++] = g[i].v[j];
+            g[i].n = k;
+        }
+        nv += g[i].n > 0 ? g[i].n : 1;
+    }
+
+    v = aalloc(&xarena,(nv+1)*sizeof(char *));
+    nv = 0;
+    for (i=0;i<n;i++) {
+        if (g[i].n == 0)        /* no match: keep the word */
+            v[nv++] = w[i];
+        for (j=0;j<g[i].n;j++)
+            v[nv++] = g[i].v[j];
+    }
+    v[nv] = NULL;
+    *nw = nv;
+    return v;
+}
+
+/*------------------------------------------------------------------*/
+/* Return a copy of the pipeline pl, allocated from xarena, with    */
+/* its expansions (including pathname expansion) done. Return NULL */
+/* (after displaying a message) if there's an error.                */
+/*------------------------------------------------------------------*/
+struct node *expand(struct node *pl)
+{
+    struct node *np, *c, *oc;
+    struct subst *s;
+    char *p, *e;
+    int nsub, n, i, k, err;
+
+    nsub = 0;           /* count the command substitutions */
+    for (k=0;k<pl->u.pipe.ns;k++) {
+        oc = pl->u.pipe.stage[k];
+        for (i=0;i<oc->u.cmd.nassign+oc->u.cmd.argc;i++) {
+            p = i < oc->u.cmd.nassign ? oc->u.cmd.assign[i]
+                : oc->u.cmd.argv[i-oc->u.cmd.nassign];
+            for (;(p=findexp(p,&e))!=NULL;p=e)
+                nsub += p[1] == '(';
+        }
+    }
+    s = aalloc(&xarena,nsub*sizeof(struct subst));
+    n = 0;              /* and start them, in the same order */
+    for (k=0;k<pl->u.pipe.ns;k++) {
+        oc = pl->u.pipe.stage[k];
+        for (i=0;i<oc->u.cmd.nassign+oc->u.cmd.argc;i++) {
+            p = i < oc->u.cmd.nassign ? oc->u.cmd.assign[i]
+                : oc->u.cmd.argv[i-oc->u.cmd.nassign];
+            for (;(p=findexp(p,&e))!=NULL;p=e)
+                if (p[1] == '(')
+                    startsubst(p+2,e-p-3,&s[n++]);
+        }
+    }
+    err = readsubst(s,nsub);
+
+    np = aalloc(&xarena,sizeof(struct node));
+    *np = *pl;
+    np->u.pipe.stage = aalloc(&xarena,pl->u.pipe.ns*sizeof(struct node *));
+    n = 0;
+    for (k=0;err==0 && k<pl->u.pipe.ns;k++) {
+        oc = pl->u.pipe.stage[k];
+        c = aalloc(&xarena,sizeof(struct node));
+        *c = *oc;
+        c->u.cmd.assign = expandwords(oc->u.cmd.assign,oc->u.cmd.nassign,
+                                      s,&n,0,&c->u.cmd.nassign);
+        c->u.cmd.argv = expandwords(oc->u.cmd.argv,oc->u.cmd.argc,s,&n,
+                                    oc->u.cmd.b != &assignb,&c->u.cmd.argc);
+        if (oc->u.cmd.b != &assignb)
+            c->u.cmd.argv = globwords(c->u.cmd.argv,c->u.cmd.argc,
+                                      &c->u.cmd.argc);
+        if (c->u.cmd.argc == 0 && c->u.cmd.nassign == 0) {
+            write(2,"*** ERROR: Missing command.\n",28);
+            err = -1;
+        } else if (c->u.cmd.argc == 0) {    /* just assignments now */
+            c->u.cmd.argv = c->u.cmd.assign;
+            c->u.cmd.argc = c->u.cmd.nassign;
+            c->u.cmd.nassign = 0;
+            c->u.cmd.b = &assignb;
+        } else if (c->u.cmd.b != &assignb)
+            c->u.cmd.b = findbuiltin(c->u.cmd.argv[0]);
+        np->u.pipe.stage[k] = c;
+    }
+
+    for (i=0;i<nsub;i++)
+        free(s[i].buf);
+    return err == 0 ? np : NULL;
+}
+
+/*------------------------------------------------------------------*/
+/* Run the builtin command c in the shell itself, and return its    */
+/* exit status. If the command has redirections, the shell's own    */
+/* descriptors 0, 1 and 2 are changed while it runs, and then put   */
+/* back.                                                            */
+/*------------------------------------------------------------------*/
+int runbuiltin(struct node *c)
+{
+    int fd[3], saved[3];
+    int opened[c->u.cmd.nredir+3];
+    int i, n, st;
+
+    if (c->u.cmd.redir == NULL)
+        return c->u.cmd.b->func(c->u.cmd.argc,c->u.cmd.argv);
+
+    fd[0] = 0;
+    fd[1] = 1;
+    fd[2] = 2;
+    n = 0;
+    st = 1;
+    if (redirect(c->u.cmd.redir,fd,opened,&n) == 0) {
+        fflush(stdout);
+        for (i=0;i<3;i++) {
+            saved[i] = -1;
+            if (fd[i] != i) {
+                saved[i] = fcntl(i,F_DUPFD_CLOEXEC,3);
+                dup2(fd[i],i);
+            }
+        }
+        st = c->u.cmd.b->func(c->u.cmd.argc,c->u.cmd.argv);
+        fflush(stdout);
+        fflush(stderr);
+        for (i=0;i<3;i++)
+            if (saved[i] != -1) {
+                dup2(saved[i],i);
+                close(saved[i]);
+            }
+    }
+    for (i=0;i<n;i++)
+        close(opened[i]);
+    return st;
+}
+
+/*------------------------------------------------------------------*/
+/* Run the pipeline pl. A pipeline that is a single builtin command */
+/* is run by the shell itself (unless it is a background job, bg).  */
+/* Otherwise 'pipeline' runs it. Set *status to its status (as from */
+/* wait). Return -1 if it cannot be executed, and 0 otherwise.      */
+/*------------------------------------------------------------------*/
+/* A pipeline prefixed with "time" has its times displayed when it  */
+/* is done, and with -s every command's times are recorded. The     */
+/* command substitutions in pl are done first.                      */
+/*------------------------------------------------------------------*/
+int runpipe(struct node *pl, int bg, int *status)
+{
+    struct node *c;
+    struct cstat cs;        /* times for the pipeline */
+    struct timespec t0, t1;
+    struct rusage ru0, ru1;
+    struct amark m;
+    int timed;
+
+    timed = pl->u.pipe.timed;
+    memset(&cs,0,sizeof(cs));
+    amark(&xarena,&m);          /* for expanded words, environments */
+    if ((pl->u.pipe.dollar || pl->u.pipe.wild)
+            && (pl = expand(pl)) == NULL) {
+        arelease(&xarena,&m);
+        laststatus = 1;
+        return -1;
+    }
+    c = pl->u.pipe.stage[0];
+    if (pl->u.pipe.ns == 1 && !bg && c->u.cmd.b != NULL) {
+        if (timed || dostats) {
+            clock_gettime(CLOCK_MONOTONIC,&t0);
+            getrusage(RUSAGE_SELF,&ru0);
+        }
+        *status = runbuiltin(c) << 8;
+        if (timed || dostats) {
+            clock_gettime(CLOCK_MONOTONIC,&t1);
+            getrusage(RUSAGE_SELF,&ru1);
+            cs.real = elapsed(&t0,&t1);
+            cs.user = (ru1.ru_utime.tv_sec - ru0.ru_utime.tv_sec)
+                      + (ru1.ru_utime.tv_usec - ru0.ru_utime.tv_usec) / 1e6;
+            cs.sys = (ru1.ru_stime.tv_sec - ru0.ru_stime.tv_sec)
+                     + (ru1.ru_stime.tv_usec - ru0.ru_stime.tv_usec) / 1e6;
+            cs.maxrss = ru1.ru_maxrss;
+        }
+    } else if (pipeline(pl,bg,status,&cs) == -1) {
+        arelease(&xarena,&m);
+        laststatus = 127;
+        return -1;          /* command cannot be executed */
+    }
+
+    if (!bg && timed)
+        puttime(&cs);
+    if (!bg && dostats) {
+        cmdtext(cs.cmd,sizeof(cs.cmd),pl);
+        cs.status = exitstatus(*status);
+        putrow(&cs);
+        if (maxpar == 0)
+            account(&cs);       /* else the line is accounted for */
+    }
+    arelease(&xarena,&m);
+    if (!bg)
+        laststatus = exitstatus(*status);
+    return 0;
+}
+
+/*--------------------------------------------------*/
+/* Execute the command line t (from 'parse'), if    */
+/* possible, and return its status (as from wait). */
+/*--------------------------------------------------*/
+/* This is the "meat" of the shell. It creates the  */
+/* child process to execute a command, and then it  */
+/* replaces the "cloned" shell in the child process */
+/*  with the executable program of the new command, */
+/* passing it the command line arguments and a copy */
+/* of the shell's environment.                      */
+/*--------------------------------------------------*/
+/* A command may be a pipeline: several commands    */
+/* separated by "|" words, run by 'pipeline'. A     */
+/* command followed by "&" runs in the background.  */
+/* If a command cannot be executed, or an && or ||  */
+/* operator says so, the rest of the line is not    */
+/* executed.                                        */
+/*--------------------------------------------------*/
+int execute(struct node *t)
+{
+    int status, bg;
+
+    status = 0;
+    while (t != NULL) {
+        if (t->type == N_PIPE) {    /* last pipeline on the line */
+            runpipe(t,0,&status);
+            break;
+        }
+
+        bg = t->type == N_BG;
+        if (runpipe(t->u.op.left,bg,&status) == -1)
+            break;          /* command cannot be executed */
+
+        if (t->type == N_AND && status != 0)
+            break;
+        if (t->type == N_OR && status == 0)
+            break;
+        t = t->u.op.right;      /* ";", "&", or continue */
+    }
+    return status;
+}
+
+/*------------------------------------------------------------------*/
+/* Scripts run by the source (or ".") command are parsed only once. */
+/* Each parsed script is kept on the 'scripts' list with the        */
+/* identity, size and modification time of its file, and is parsed  */
+/* again only when the file changes. So a script that is sourced    */
+/* many times is read, lexed and parsed just the first time.        */
+/*------------------------------------------------------------------*/
+struct script {
+    struct script *next;    /* next script on the list */
+    char *name;         /* file name, as given to source */
+    dev_t dev;          /* identity of the file */
+    ino_t ino;
+    off_t size;         /* size of the file */
+    struct timespec mtime;  /* modification time of the file */
+    int busy;           /* # of source commands running it */
+    int nlines;         /* # of (non-empty) lines */
+    struct node **lines;    /* the parsed lines */
+    struct arena a;     /* memory for the text and lines */
+} *scripts;
+
+int depth;          /* # of source commands being executed */
+
+/*------------------------------------------------------------------*/
+/* Read and parse the file 'name' (whose status is in *sb) into sp. */
+/* Lines with errors are diagnosed and left out. A here-document's  */
+/* text is the lines after its command, up to the TAG line. Return  */
+/* 0 on success, or -1 if the file can't be read.                  */
+/*------------------------------------------------------------------*/
+int loadscript(struct script *sp, char *name, struct stat *sb)
+{
+    char *text, *p, *e, *q;
+    int fd, k;
+    ssize_t n, got;
+    size_t taglen;
+    struct node *t;
+    struct redir *r;
+
+    fd = open(name,O_RDONLY|O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    areset(&sp->a);
+    text = aalloc(&sp->a,sb->st_size+1);
+    for (got=0;got<sb->st_size;got+=n) {
+        n = read(fd,text+got,sb->st_size-got);
+        if (n <= 0)
+            break;
+    }
+    close(fd);
+    if (got < sb->st_size)
+        return -1;
+    text[got] = '\0';
+
+    k = 1;              /* count lines to size 'lines' */
+    for (p=text;*p!='\0';p++)
+        if (*p == '\n')
+            k++;
+    sp->lines = aalloc(&sp->a,k*sizeof(struct node *));
+    sp->nlines = 0;
+
+    for (p=text;*p!='\0';p=e) {
+        e = strchr(p,'\n');
+        if (e == NULL)
+            e = p + strlen(p);
+        else
+            *e++ = '\0';
+        if (!lex(&sp->a,p))
+            continue;
+        t = parse(&sp->a,words,nwds);
+        if (t == NULL)          /* still skip its here-documents */
+            alldocs(&sp->a,words,nwds);
+        for (r=heredocs;r!=NULL;r=r->nextdoc) {
+            r->text = e;        /* the following lines, up to TAG */
+            taglen = strlen(r->word);
+            for (;;) {
+                if (*e == '\0') {       /* end of file ends it too */
+                    r->len = e - r->text;
+                    break;
+                }
+                q = strchr(e,'\n');
+                q = q == NULL ? e + strlen(e) : q + 1;   /* next line */
+                if (!strncmp(e,r->word,taglen)
+                        && (e[taglen] == '\n' || e[taglen] == '\0')) {
+                    r->len = e - r->text;
+                    e = q;
+                    break;
                 }
+                e = q;
             }
-        } else {
-            /*----------------------------------------------------------*/
-            /* Command cannot be executed. Display appropriate message. */
-            /*----------------------------------------------------------*/
-            sprintf(msg,"*** ERROR: '%s' cannot be executed.\n", words[i]);
-            write(2,msg,strlen(msg));
+        }
+        if (t != NULL)
+            sp->lines[sp->nlines++] = t;
+    }
+
+    sp->dev = sb->st_dev;
+    sp->ino = sb->st_ino;
+    sp->size = sb->st_size;
+    sp->mtime = sb->st_mtim;
+    return 0;
+}
+
+/*------------------------------------------------------------------*/
+/* Return the parsed script for the file 'name', parsing it first   */
+/* if it isn't on the scripts list or its file has changed. Return  */
+/* NULL (after displaying a message) if the file can't be read.     */
+/*------------------------------------------------------------------*/
+struct script *getscript(char *name)
+{
+    struct script *sp;
+    struct stat sb;
+
+    if (stat(name,&sb) == -1) {
+        fprintf(stderr,"source: %s: %s\n", name, strerror(errno));
+        return NULL;
+    }
+    for (sp=scripts;sp!=NULL;sp=sp->next)
+        if (!strcmp(sp->name,name))
             break;
+    if (sp != NULL && (sp->busy > 0 || (sp->dev == sb.st_dev
+            && sp->ino == sb.st_ino && sp->size == sb.st_size
+            && sp->mtime.tv_sec == sb.st_mtim.tv_sec
+            && sp->mtime.tv_nsec == sb.st_mtim.tv_nsec)))
+        return sp;          /* unchanged (or in use) */
+
+    if (sp == NULL) {
+        sp = calloc(1,sizeof(struct script));
+        if (sp == NULL || (sp->name = strdup(name)) == NULL) {
+            write(2,"*** ERROR: Out of memory.\n",26);
+            exit(1);
+        }
+        sp->next = scripts;
+        scripts = sp;
+    }
+    if (loadscript(sp,name,&sb) == -1) {
+        fprintf(stderr,"source: cannot read %s\n", name);
+        sp->nlines = 0;
+        sp->size = -1;          /* parse it again next time */
+        return NULL;
+    }
+    return sp;
+}
+
+/*-----------------------------------------------------------------*/
+/* source file, or . file: execute the commands in file. The exit  */
+/* status is that of the last command executed.                    */
+/*-----------------------------------------------------------------*/
+int bi_source(int argc, char *argv[])
+{
+    struct script *sp;
+    int k, st;
+
+    if (argc < 2) {
+        fprintf(stderr,"%s: file name required\n", argv[0]);
+        return 2;
+    }
+    if (depth >= MAXDEPTH) {
+        fprintf(stderr,"%s: %s: too deeply nested\n", argv[0], argv[1]);
+        return 1;
+    }
+    sp = getscript(argv[1]);
+    if (sp == NULL)
+        return 1;
+
+    depth++;
+    sp->busy++;
+    st = 0;
+    for (k=0;k<sp->nlines;k++)
+        st = execute(sp->lines[k]);
+    sp->busy--;
+    depth--;
+    return exitstatus(st);
+}
+
+/*------------------------------------------------------------------*/
+/* Wait for one line process to end, and write any output that can  */
+/* now be written. Background jobs reaped meanwhile are recorded.   */
+/*------------------------------------------------------------------*/
+void pwait(void)
+{
+    pid_t pid;
+    int st;
+    struct rusage ru;
+
+    for (;;) {
+        pid = wait4(-1,&st,0,&ru);
+        if (pid == -1) {
+            write(2,"Wait failed.\n",13);
+            exit(1);
         }
+        if (childdone(pid,st,&ru))
+            break;          /* else part of a background job */
+    }
+    pemit();
+}
 
-        if (status == 0) {
-            if (strcmp(w, ";") == 0 || strcmp(w, "&&") == 0) {
-                i++;
-            } else {
+/*---------------------------------------------------------*/
+/* Wait for every line process to end, and write all their */
+/* output.                                                 */
+/*---------------------------------------------------------*/
+void pdrain(void)
+{
+    while (nrunning > 0)
+        pwait();
+    pemit();
+}
+
+/*------------------------------------------------------------------*/
+/* Start a line process to execute the command line t (whose words  */
+/* are in 'words'). If maxpar line processes are running already,   */
+/* first wait for one of them to end.                               */
+/*------------------------------------------------------------------*/
+void pstart(struct node *t)
+{
+    struct pline *pl;
+    int fd, in, k, n;
+    struct timespec t0, t1;
+    pid_t pid;
+
+    while (nrunning >= maxpar || pqlen == PQSIZE)
+        pwait();
+
+    fd = -1;
+    if (serialize) {
+        fd = memfd_create("prog1-line",MFD_CLOEXEC);
+        if (fd == -1) {
+            perror("memfd_create");
+            exit(1);
+        }
+    }
+
+    fflush(stdout);
+    if (dostats)
+        clock_gettime(CLOCK_MONOTONIC,&t0);
+    pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        /*------------------------------------------------------*/
+        /* The line process mustn't read (or move) the shell's  */
+        /* input, and forgets the shell's jobs and line queue.  */
+        /*------------------------------------------------------*/
+        in = open("/dev/null",O_RDONLY);
+        if (in != -1) {
+            dup2(in,0);
+            close(in);
+        }
+        ibuffered = ibufpos = ibuflen = 0;
+        memset(jobs,0,sizeof(jobs));
+        njobs = pqlen = nrunning = maxpar = 0;
+        subshell = 1;
+        if (fd != -1) {
+            dup2(fd,1);
+            dup2(fd,2);
+            flushecho();
+        }
+        execute(t);
+        fflush(stdout);
+        fflush(stderr);
+        _exit(0);
+    }
+
+    ebuflen = 0;            /* the line process wrote the echo */
+    pl = &pq[(pqhead + pqlen++) % PQSIZE];
+    pl->pid = pid;
+    pl->fd = fd;
+    pl->done = 0;
+    if (dostats) {
+        pl->start = t0;
+        clock_gettime(CLOCK_MONOTONIC,&t1);
+        pl->spawn = elapsed(&t0,&t1);
+        n = 0;
+        pl->cmd[0] = '\0';
+        for (k=0;k<nwds && n<(int)sizeof(pl->cmd);k++)
+            n += snprintf(pl->cmd+n,sizeof(pl->cmd)-n,"%s%s",
+                          k == 0 ? "" : " ", words[k]);
+    }
+    nrunning++;
+}
+
+/*------------------------------------------------------------------*/
+/* Command server (-S). Clients connect to the Unix domain socket   */
+/* and send command lines (and here-documents), just as they would  */
+/* appear in a script. The lines are run by this shell one at a     */
+/* time, taking one line from each client in turn, so variables,    */
+/* the current directory, jobs, and the command hash and directory  */
+/* caches are shared by all clients and stay warm between requests. */
+/*                                                                  */
+/* The standard input of commands is /dev/null. Their standard      */
+/* output and error, and the shell's messages, are collected in a   */
+/* memory file, and when the line is done the client is sent        */
+/*                                                                  */
+/*     <status> <n>\n<n bytes of output>                            */
+/*                                                                  */
+/* where status is the exit status of the line's last pipeline      */
+/* ($?), or 2 if the line couldn't be parsed. Blank lines get no    */
+/* reply. "exit" ends the connection, not the shell. Output that    */
+/* background commands write after their line is done is lost.     */
+/*                                                                  */
+/* Replies are sent without blocking: a client's next line isn't    */
+/* run until it has taken the last reply, so a client that stops    */
+/* reading holds up only itself.                                    */
+/*------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------*/
+/* Close the connection to client cl and free its slot.          */
+/*---------------------------------------------------------------*/
+void clientclose(struct client *cl)
+{
+    close(cl->fd);
+    if (cl->out != -1)
+        close(cl->out);
+    free(cl->buf);
+    memset(cl,0,sizeof(struct client));
+    cl->fd = cl->out = -1;
+}
+
+/*------------------------------------------------------------------*/
+/* Send as much of client cl's reply as its socket will take now.   */
+/* Return 0 if it's all sent or the rest must wait until poll finds */
+/* the socket writable, or -1 if the client can't be sent to.       */
+/*------------------------------------------------------------------*/
+int clientsend(struct client *cl)
+{
+    ssize_t n;
+    int again;
+    void (*oldpipe)(int);
+
+    oldpipe = signal(SIGPIPE,SIG_IGN);  /* the client may be gone */
+    n = 1;
+    while (n > 0 && cl->hdrpos < cl->hdrlen) {
+        n = write(cl->fd,cl->hdr+cl->hdrpos,cl->hdrlen-cl->hdrpos);
+        if (n > 0)
+            cl->hdrpos += n;
+    }
+    while (n > 0 && cl->outpos < cl->outlen)
+        n = sendfile(cl->fd,cl->out,&cl->outpos,cl->outlen-cl->outpos);
+    again = n == -1 && (errno == EAGAIN || errno == EINTR);
+    signal(SIGPIPE,oldpipe);
+    if (n > 0) {            /* all sent */
+        close(cl->out);
+        cl->out = -1;
+        return 0;
+    }
+    return again ? 0 : -1;
+}
+
+/*------------------------------------------------------------------*/
+/* Return non-zero if the here-documents of the line that starts at */
+/* p and ends at nl (a newline) in client cl's buffer are all there */
+/* too: for each of them, a line that is just its TAG follows.      */
+/*------------------------------------------------------------------*/
+int docsready(struct client *cl, char *p, char *nl)
+{
+    struct redir r;
+    char *s, *w, *copy, *e, *end, *q;
+    size_t taglen;
+    int open, len, ready;
+
+    copy = malloc(nl - p + 1);      /* nextword changes the line */
+    if (copy == NULL)
+        return 1;           /* let hereinput find out */
+    memcpy(copy,p,nl-p);
+    copy[nl-p] = '\0';
+    s = copy;
+    open = 0;
+    e = nl + 1;             /* where the next text starts */
+    end = cl->buf + cl->len;
+    ready = 1;
+    while (ready && (w = nextword(&s,&open)) != NULL) {
+        len = isredir(w,&r);
+        if (len == 0 || r.type != R_HEREDOC)
+            continue;
+        r.word = w + len;
+        if (*r.word == '\0' && (r.word = nextword(&s,&open)) == NULL)
+            break;              /* no TAG, so no text */
+        taglen = strlen(r.word);
+        for (;;) {              /* find the TAG line */
+            q = memchr(e,'\n',end-e);
+            if (q == NULL) {
+                ready = 0;
                 break;
             }
-        } else {
-            if (strcmp(w, ";") == 0 || strcmp(w, "||") == 0) {
-                i++;
-            } else {
+            if ((size_t)(q-e) == taglen && !memcmp(e,r.word,taglen)) {
+                e = q + 1;
                 break;
             }
+            e = q + 1;
+        }
+    }
+    free(copy);
+    return ready;
+}
+
+/*------------------------------------------------------------------*/
+/* Return non-zero if a complete (non-blank) line from client cl,   */
+/* with the text of its here-documents, is in its buffer, so it can */
+/* be run without waiting for this client (and holding up the       */
+/* others). Blank lines before it are discarded. After end of file, */
+/* a complete line is enough, since the rest won't come.            */
+/*------------------------------------------------------------------*/
+int clientready(struct client *cl)
+{
+    char *p, *nl;
+    size_t i;
+
+    for (;;) {
+        p = cl->buf + cl->pos;
+        nl = memchr(p,'\n',cl->len-cl->pos);
+        if (nl == NULL)
+            return 0;
+        for (i=0;p+i<nl && (p[i]==' ' || p[i]=='\t');i++)
+            ;
+        if (p + i < nl)
+            return cl->eof || docsready(cl,p,nl);
+        cl->pos += nl - p + 1;      /* blank line */
+    }
+}
+
+/*------------------------------------------------------------------*/
+/* Run the next command line from client cl (see clientready), and  */
+/* make its reply cl's output (sent by clientsend).                 */
+/*------------------------------------------------------------------*/
+void clientline(struct client *cl)
+{
+    struct node *t;
+    struct redir *r;
+    int out, save1, save2, status;
+    struct stat sb;
+
+    out = memfd_create("prog1-reply",MFD_CLOEXEC);
+    if (out == -1) {
+        perror("memfd_create");
+        exit(1);
+    }
+    fflush(stdout);
+    save1 = fcntl(1,F_DUPFD_CLOEXEC,3);
+    save2 = fcntl(2,F_DUPFD_CLOEXEC,3);
+    dup2(out,1);
+    dup2(out,2);
+
+    reapjobs();
+    areset(&linearena);
+    curclient = cl;
+    status = 2;
+    if (Getline() && lex(&linearena,line)) {
+        t = parse(&linearena,words,nwds);
+        if (t == NULL)
+            alldocs(&linearena,words,nwds);
+        for (r=heredocs;r!=NULL;r=r->nextdoc)
+            hereinput(r);
+        if (t != NULL) {
+            if (!noexec)
+                execute(t);
+            status = laststatus;
+        }
+    }
+    curclient = NULL;
+
+    fflush(stdout);
+    fflush(stderr);
+    dup2(save1,1);
+    dup2(save2,2);
+    close(save1);
+    close(save2);
+
+    if (fstat(out,&sb) == -1) {
+        close(out);
+        return;
+    }
+    cl->out = out;
+    cl->outpos = 0;
+    cl->outlen = sb.st_size;
+    cl->hdrlen = sprintf(cl->hdr,"%d %lld\n", status, (long long)sb.st_size);
+    cl->hdrpos = 0;
+}
+
+/*------------------------------------------------------------------*/
+/* Listen for clients on the Unix domain socket 'name', and run the */
+/* command lines they send. This doesn't return.                    */
+/*------------------------------------------------------------------*/
+void cmdserver(char *name)
+{
+    struct sockaddr_un sa;
+    struct pollfd pfd[NCLIENTS+1];
+    struct stat sb;
+    struct client *cl;
+    int ls, fd, i, busy;
+    ssize_t n;
+
+    if (strlen(name) >= sizeof(sa.sun_path)) {
+        fprintf(stderr,"Socket name too long: %s\n", name);
+        exit(1);
+    }
+    memset(&sa,0,sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    strcpy(sa.sun_path,name);
+    if (lstat(name,&sb) == 0 && S_ISSOCK(sb.st_mode))
+        unlink(name);           /* left by an earlier server */
+    ls = socket(AF_UNIX,SOCK_STREAM|SOCK_CLOEXEC,0);
+    if (ls == -1 || bind(ls,(struct sockaddr *)&sa,sizeof(sa)) == -1
+            || listen(ls,SOMAXCONN) == -1) {
+        perror(name);
+        exit(1);
+    }
+
+    fd = open("/dev/null",O_RDONLY);    /* commands' standard input */
+    if (fd != -1) {
+        dup2(fd,0);
+        close(fd);
+    }
+    ibuffered = isterm = 0;
+    for (i=0;i<NCLIENTS;i++)
+        clients[i].fd = clients[i].out = -1;
+
+    for (busy=0;;) {
+        /*-----------------------------------------------------------*/
+        /* Wait for a connection, input, or room to send a reply,    */
+        /* but not if a line is waiting to be run already.           */
+        /*-----------------------------------------------------------*/
+        pfd[0].fd = ls;
+        pfd[0].events = POLLIN;
+        for (i=0;i<NCLIENTS;i++) {
+            cl = &clients[i];
+            pfd[i+1].fd = cl->fd;
+            pfd[i+1].events = (cl->eof ? 0 : POLLIN)
+                              | (cl->out != -1 ? POLLOUT : 0);
+            pfd[i+1].revents = 0;
+        }
+        if (poll(pfd,NCLIENTS+1,busy ? 0 : -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            exit(1);
+        }
+        if (pfd[0].revents & POLLIN) {
+            fd = accept4(ls,NULL,NULL,SOCK_CLOEXEC|SOCK_NONBLOCK);
+            for (i=0;fd!=-1 && i<NCLIENTS && clients[i].fd!=-1;i++)
+                ;
+            if (i < NCLIENTS)
+                clients[i].fd = fd;
+            else if (fd != -1)
+                close(fd);          /* too many clients */
+        }
+
+        /*-----------------------------------------------------------*/
+        /* Read the input that's arrived, send what replies can be   */
+        /* sent, and run one line from each client that has one and  */
+        /* has taken its last reply.                                 */
+        /*-----------------------------------------------------------*/
+        busy = 0;
+        for (i=0;i<NCLIENTS;i++) {
+            cl = &clients[i];
+            if (cl->fd == -1)
+                continue;
+            if ((pfd[i+1].revents & (POLLIN|POLLHUP|POLLERR))
+                    && pfd[i+1].fd == cl->fd && !cl->eof) {
+                n = clientfill(cl);
+                if (n == 0 || (n == -1 && errno != EAGAIN))
+                    cl->eof = 1;
+            }
+            if (cl->out != -1 && clientsend(cl) == -1) {
+                clientclose(cl);
+                continue;
+            }
+            if (cl->out == -1 && clientready(cl)) {
+                clientline(cl);
+                if (clientquit) {   /* send the reply, then close */
+                    clientquit = 0;
+                    cl->pos = cl->len;
+                    cl->eof = 1;
+                }
+                if (cl->out != -1 && clientsend(cl) == -1) {
+                    clientclose(cl);
+                    continue;
+                }
+            }
+            if (cl->out != -1)
+                continue;           /* wait to send the rest */
+            if (clientready(cl))
+                busy = 1;
+            else if (cl->eof)
+                clientclose(cl);    /* end of file, and no more lines */
         }
     }
 }
@@ -314,11 +4271,116 @@ int execute(void)
 /*---------------------------------------------------------------*/
 int main(int argc, char *argv[])
 {
-    while (Getline()) {         /* get command line */
-        if (!lex())         /* do lexical analysis to get words */
-            continue;               /* some problem, so ignore it */
-        execute();          /* execute the command */
+    char *msg;
+    char *sockname = NULL;      /* socket to listen on (-S) */
+    struct node *t;         /* the parsed command line */
+    struct redir *r;
+
+    /*-----------------*/
+    /* Handle options. */
+    /*-----------------*/
+    while (argc > 1 && argv[1][0] == '-') {
+        if (!strcmp(argv[1],"-n"))
+            noexec = 1;
+        else if (!strcmp(argv[1],"-u"))
+            unbuffered = 1;
+        else if (!strcmp(argv[1],"-R"))
+            relaymode = 1;
+        else if (!strcmp(argv[1],"-o"))
+            serialize = 1;
+        else if (!strcmp(argv[1],"-s") && argc > 2) {
+            dostats = 1;
+            statfd = open(argv[2],O_WRONLY|O_CREAT|O_TRUNC|O_APPEND|O_CLOEXEC,
+                          0666);
+            if (statfd == -1) {
+                fprintf(stderr,"Cannot open %s for output.\n", argv[2]);
+                exit(1);
+            }
+            msg = "command,status,real,user,sys,spawn,maxrss_kb\n";
+            write(statfd,msg,strlen(msg));
+            argc--;
+            argv++;
+        }
+        else if (!strcmp(argv[1],"-j") && argc > 2) {
+            maxpar = atoi(argv[2]);
+            if (maxpar < 1) {
+                fprintf(stderr,"Bad value for -j: %s\n", argv[2]);
+                exit(1);
+            }
+            argc--;
+            argv++;
+        }
+        else if (!strcmp(argv[1],"-e") && argc > 2) {
+            if (!strcmp(argv[2],"fork"))
+                engine = E_FORK;
+            else if (!strcmp(argv[2],"spawn"))
+                engine = E_SPAWN;
+            else if (!strcmp(argv[2],"server"))
+                engine = E_SERVER;
+            else {
+                fprintf(stderr,"Unknown engine %s\n", argv[2]);
+                exit(1);
+            }
+            argc--;
+            argv++;
+        }
+        else if (!strcmp(argv[1],"-S") && argc > 2) {
+            sockname = argv[2];
+            argc--;
+            argv++;
+        } else {
+            fprintf(stderr,"Unknown option %s\n", argv[1]);
+            fprintf(stderr,"Usage: prog1 [-n] [-u] [-e fork|spawn|server] [-R] "
+                    "[-j N [-o]] [-s statsfile] [-S socket]\n");
+            exit(1);
+        }
+        argc--;
+        argv++;
+    }
+
+    if (serialize && maxpar == 0) {
+        fprintf(stderr,"The -o option requires -j.\n");
+        exit(1);
+    }
+    if (sockname != NULL && maxpar > 0) {
+        fprintf(stderr,"The -S and -j options can't be used together.\n");
+        exit(1);
+    }
+    holdecho = serialize;
+    if (engine == E_SERVER)
+        startserver();          /* while the shell is still small */
+
+    initvars();             /* variables from the environment */
+    if (sockname != NULL)
+        cmdserver(sockname);        /* doesn't return */
+    isterm = isatty(0);         /* see if file descriptor 0 is a terminal */
+    ibuffered = !isterm && !unbuffered && lseek(0,0,SEEK_CUR) != -1;
+
+    for (;;) {
+        reapjobs();         /* reap finished background jobs */
+        areset(&linearena);     /* free the previous line, all at once */
+        if (!Getline())         /* get command line */
+            break;
+        if (!lex(&linearena,line))  /* do lexical analysis to get words */
+            continue;               /* no words, so ignore it */
+        t = parse(&linearena,words,nwds);   /* parse the words */
+        if (t == NULL)          /* a bad line's are read too */
+            alldocs(&linearena,words,nwds);
+        for (r=heredocs;r!=NULL;r=r->nextdoc)
+            hereinput(r);       /* read here-documents */
+        if (t == NULL || noexec)
+            continue;
+        if (maxpar == 0)
+            execute(t);         /* execute the command */
+        else if (firstcmd(t)->u.cmd.b != NULL) {
+            pdrain();           /* builtins wait for earlier lines */
+            flushecho();
+            execute(t);
+        } else
+            pstart(t);          /* execute it in a line process */
     }
+    pdrain();
+    statsummary();
     write(1,"\n",1);            /* display an end of line. */
     return 0;               /* successful shell termination */
 }
\ No newline at end of file
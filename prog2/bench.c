@@ -0,0 +1,152 @@
+/*--------------------------------------------------------------------*/
+/* Scaling benchmark for prog2.                                       */
+/*                                                                    */
+/* Usage:    prog2_bench [-p prog2path] [-t maxsecs] [nproc...]       */
+/*                                                                    */
+/* For each number of processes, a simulation is generated in which   */
+/* every process repeatedly locks one of the resources, computes,     */
+/* and unlocks it (so there is contention, but no deadlock), and      */
+/* prog2 is run on it. The elapsed time and the time per simulated    */
+/* step are reported; if the cost of a step doesn't depend on the     */
+/* number of processes, the time per step stays the same as the       */
+/* number of processes grows.                                         */
+/*                                                                    */
+/* Without nproc arguments, the number of processes starts at 256     */
+/* and doubles until it reaches 2^20 or a run takes more than maxsecs */
+/* (default 10) seconds.                                              */
+/*--------------------------------------------------------------------*/
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NRSRC 50        /* # of resources in the simulations */
+#define STEPS 9         /* run time of each process */
+#define MAXNP (1<<20)   /* largest default # of processes */
+
+char *prog2 = "./prog2";    /* path to the program being measured */
+double maxsecs = 10;        /* stop doubling after a run this long */
+
+/*------------------------------------------------------------------*/
+/* Create the input file 'name' with one simulation of np processes */
+/* sharing NRSRC resources. Each process has a run time of STEPS.   */
+/*------------------------------------------------------------------*/
+void mkinput(char *name, int np)
+{
+    FILE *sf;
+    int i, r1, r2;
+
+    sf = fopen(name,"w");
+    if (sf == NULL) {
+        fprintf(stderr,"Cannot create %s.\n", name);
+        exit(1);
+    }
+    fprintf(sf,"%d %d\n", np, NRSRC);
+    for (i=0;i<np;i++) {
+        r1 = i % NRSRC + 1;
+        r2 = (i * 7 + 3) % NRSRC + 1;
+        fprintf(sf,"8 L%d C2 U%d L%d C1 U%d C1 C1\n", r1, r1, r2, r2);
+    }
+    fprintf(sf,"0 0\n");
+    fclose(sf);
+}
+
+/*-------------------------------------------------------------------*/
+/* Run prog2 with the named input file, discarding its output, and   */
+/* return the elapsed time in seconds.                               */
+/*-------------------------------------------------------------------*/
+double run(char *input)
+{
+    int fd, st;
+    pid_t pid;
+    struct timeval t0, t1;
+
+    gettimeofday(&t0,NULL);
+    pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        fd = open("/dev/null",O_WRONLY);
+        dup2(fd,1);
+        close(fd);
+        execl(prog2,prog2,input,(char *)NULL);
+        perror(prog2);
+        _exit(1);
+    }
+    waitpid(pid,&st,0);
+    gettimeofday(&t1,NULL);
+    if (!WIFEXITED(st) || WEXITSTATUS(st) != 0) {
+        fprintf(stderr,"%s failed on %s.\n", prog2, input);
+        exit(1);
+    }
+    return (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1e6;
+}
+
+/*-----------------------------------------------------*/
+/* Generate and run the simulation with np processes,  */
+/* display the results, and return the elapsed time.   */
+/*-----------------------------------------------------*/
+double bench(int np)
+{
+    char *input = "bench_prog2.txt";
+    double secs;
+
+    mkinput(input,np);
+    secs = run(input);
+    unlink(input);
+    printf("%6d processes  %9.3f s  %10.3f us/step\n",
+           np, secs, secs * 1e6 / ((double)np * STEPS));
+    fflush(stdout);
+    return secs;
+}
+
+int main(int argc, char *argv[])
+{
+    int np;
+
+    /*-----------------*/
+    /* Handle options. */
+    /*-----------------*/
+    while (argc > 1 && argv[1][0] == '-') {
+        if (!strcmp(argv[1],"-p") && argc > 2) {
+            prog2 = argv[2];
+            argc -= 2;
+            argv += 2;
+            continue;
+        }
+        if (!strcmp(argv[1],"-t") && argc > 2) {
+            maxsecs = atof(argv[2]);
+            argc -= 2;
+            argv += 2;
+            continue;
+        }
+        fprintf(stderr,"Unknown option %s\n", argv[1]);
+        fprintf(stderr,"Usage: prog2_bench [-p prog2path] [-t maxsecs] "
+                "[nproc...]\n");
+        exit(1);
+    }
+
+    if (argc == 1) {
+        for (np=256;;np*=2) {
+            if (np > MAXNP)
+                np = MAXNP;
+            if (bench(np) > maxsecs || np == MAXNP)
+                break;
+        }
+    }
+    for (;argc>1;argc--,argv++) {
+        np = atoi(argv[1]);
+        if (np < 1) {
+            fprintf(stderr,"Bad number of processes %s\n", argv[1]);
+            exit(1);
+        }
+        bench(np);
+    }
+    return 0;
+}
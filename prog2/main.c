@@ -1,18 +1,82 @@
 /*--------------------------------------------------------------------*/
 /* Modified by Joseph Aulner                                          */
 /*                                                                    */
-/* Usage:    prog2 [-v] [inputfilename]                               */
+/* Usage:    prog2 [-v] [-T tracefile] [-j N] [inputfilename]         */
+/*                                                                    */
+/* With -j, up to N simulations are run at the same time, each in its */
+/* own thread; the output of every simulation is still displayed in   */
+/* order, exactly as it would be without -j.                          */
+/*                                                                    */
+/* With -T, every step of each simulation is recorded in tracefile,   */
+/* like -v does, but in binary records instead of text. prog2_trace   */
+/* displays the trace as text.                                        */
 /*--------------------------------------------------------------------*/
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+/*------------------------------------------------------------------*/
+/* The input data. When it is a regular file, the whole file is     */
+/* mapped into memory and inbuf points to it. Otherwise (a pipe or  */
+/* terminal, usually the standard input) inbuf holds the last block */
+/* read from infd, and is refilled when it has all been used. The   */
+/* next character to be read is *inp, and inend is the end of the   */
+/* data in inbuf.                                                   */
+/*------------------------------------------------------------------*/
+#define INBUF (1<<20)   /* # of chars read from a pipe at a time */
 
-#define MAXSTEP 50  /* max action steps for any process */
-#define MAXPROC 50  /* max processes in any simulation */
-#define MAXRSRC 50  /* max resources in any simulation */
+int infd;       /* input file descriptor */
+int inmapped;       /* non-zero if the input file is mapped */
+char *inbuf;        /* the input data */
+char *inp;      /* next char in inbuf */
+char *inend;        /* end of the data in inbuf */
 
-FILE *f;        /* input stream */
+/*-----------------------------------------------------------*/
+/* Get the next input character, or EOF at the end of input. */
+/* Back up one character with inp--, unless it was EOF.       */
+/*-----------------------------------------------------------*/
+#define nextc() (inp < inend ? (unsigned char)*inp++ : fillin())
 
+int trace;      /* trace option value */
+int tfd = -1;       /* trace file descriptor (-T), or -1 */
+int logsteps;       /* non-zero if every step is recorded (-v or -T) */
+int njobs;      /* # of worker threads (-j), or 0 for no threads */
+FILE *errout;       /* where getinput's error messages go */
+
+/*------------------------------------------------------------------*/
+/* A record in the trace file, for one event in a simulation. The   */
+/* file starts with the 8 characters of TMAGIC, followed by records */
+/* in the order the events happened. prog2_trace (trace.c) reads    */
+/* the file, and these definitions must be the same there.          */
+/*------------------------------------------------------------------*/
+#define TMAGIC "prog2tr1"
+
+struct trec {
+    int t;      /* simulation time */
+    int p;      /* process (or simulation # in a TSIM record) */
+    int v;      /* value for the action, or resource */
+    char kind;      /* kind of event (below) */
+    char a;     /* the action (L, U or C) in a TSTEP record */
+    char pad[2];
+};
+
+#define TSIM 1      /* start of simulation p */
+#define TSTEP 2     /* process p takes action a with value v */
+#define TALLOC 3    /* resource v allocated to process p */
+#define TUNAVAIL 4  /* resource v unavailable */
+#define TRELEASE 5  /* resource v released */
+#define TUNBLOCK 6  /* process p unblocked */
+#define TTERM 7     /* process p terminated */
+
+#define TBUF 65536  /* # of records in a trace buffer */
 
 /*----------------------------------------------------------------*/
 /* There are several arrays used to record information about the  */
@@ -22,69 +86,51 @@ FILE *f;        /* input stream */
 /* 0-origin arrays. This makes the code easier to understand at   */
 /* the cost of one array entry.                                   */
 /*----------------------------------------------------------------*/
+/* The arrays are allocated dynamically, and made larger when a   */
+/* simulation needs more room than earlier ones, so there is no   */
+/* limit on the number of processes, resources or actions, and    */
+/* the memory used is proportional to the largest simulation.     */
+/*----------------------------------------------------------------*/
+/* All of them, and everything else about a simulation, are kept  */
+/* in a sim structure (below), so that several simulations can be */
+/* run at the same time by different threads (with -j).           */
+/*----------------------------------------------------------------*/
 
 /*------------------------------------------------------------------*/
-/* This is an array of structures with one entry for every process. */
-/* Each entry contains the "program" that will be executed by the   */
-/* process (ns, a, and n), the index in the a and n arrays of the   */
-/* next action to be taken, the state of the process, the total     */
-/* time used by the process, and the time when it ended.            */
+/* Information about the processes is kept in a structure of        */
+/* arrays, with one entry in each array for every process, so the   */
+/* fields used at every step (ip, state, runtime, next) are each    */
+/* packed together. The "program" executed by process p is ns[p]    */
+/* actions, kept with those of every other process in the act and   */
+/* val arrays, starting at act[start[p]] and val[start[p]]. ip[p]   */
+/* is the index (from start[p]) of the next action to be taken.     */
 /*------------------------------------------------------------------*/
-struct process {
-    int ns;     /* # of actions for this process */
-    char a[MAXSTEP];    /* actions */
-    int n[MAXSTEP]; /* parameters (resource ID or time) */
-    int ip;     /* index to next action */
-    int state;      /* process state */
+struct procs {
+    int *ns;        /* # of actions for each process */
+    int *start;     /* index in act and val of its first action */
+    int *ip;        /* index to next action */
+    int *state;     /* process state */
     /* -1 = finished */
     /* 0 = ready (or running) */
     /* 1..nr = blocked, waiting on resource */
-    int runtime;    /* time used */
-    int endtime;    /* time process ended */
-} proc[MAXPROC+1];
-
-int trace;      /* trace option value */
-
-int simno;      /* simulation number */
-int t;          /* simulation time */
-int np;         /* total # of processes (1..MAXPROC) */
-int nr;         /* total # of resources (1..MAXRSRC) */
+    int *runtime;   /* time used */
+    int *endtime;   /* time process ended */
+    int *next;      /* next process on the same queue (0 = none) */
+    int *mark;      /* used when finding deadlocked processes */
+};
 
 /*--------------------------------------------------------------------*/
-/* The following two items represent a very simple queue that records */
-/* the "ready" processes (actually, the indices in the "proc" array   */
-/* of the ready processes). The number of entries in the queue is     */
-/* nready. If nready > 0, then the first entry in the queue is in     */
-/* ready[0], and the last entry is in ready[nready-1]. This could be  */
-/* made a lot "swifter" with dynamic allocation (i.e. using a linked  */
-/* list for the queue), but in this case, we're not so concerned with */
-/* speed.                                                             */
+/* A queue of processes (their indices in the "proc" array), in FIFO  */
+/* order. A process is on at most one queue at a time (the ready      */
+/* queue, or the queue of one resource it is waiting for), so the     */
+/* queues are linked through the "next" member of the proc entries,   */
+/* and adding or removing a process takes constant time.              */
 /*--------------------------------------------------------------------*/
-int nready;     /* # of ready processes (0..np) */
-int ready[MAXPROC]; /* the ready queue (each in 1..np) */
-
-
-int running;        /* ID of the running process (1..np) */
-
-/*------------------------------------------------------------------*/
-/* The next three arrays are used to record information about the   */
-/* resources. rstate[r] is 0 if resource r is not being used. If    */
-/* resource r is being used by process p, then rstate[r] = p.       */
-/* If there are any processes waiting for the resource, then their  */
-/* process IDs will appear on a queue associated with the resource  */
-/* being awaited. For example, suppose process 3 "owns" resource 4, */
-/* and processes 1 and 2 (in that order) have attempted to gain     */
-/* mutually-exclusive access to the resource. We'd then have this:  */
-/*  rstate[4] = 3       process 3 owns resource 4           */
-/*  nrw[4] = 2      2 procs are waiting for resource 4  */
-/*  rw[4][0] = 1        process 1 is first waiting proc     */
-/*  rw[4][1] = 2        process 2 is second waiting proc    */
-/*------------------------------------------------------------------*/
-int rstate[MAXRSRC+1];  /* resource state */
-/* 0 = unused */
-/* 1..np = owned by process */
-int rw[MAXRSRC+1][MAXPROC+1];   /* queues of waiting processes */
-int nrw[MAXRSRC+1];     /* # of procs on each queue */
+struct queue {
+    int head;       /* first process (1..np), or 0 if empty */
+    int tail;       /* last process (1..np) */
+    int n;      /* # of processes on the queue */
+};
 
 /*---------------------------------------------------------------*/
 /* Node of the resource graph. There is an edge from a resource  */
@@ -93,16 +139,72 @@ int nrw[MAXRSRC+1];     /* # of procs on each queue */
 /* process is awaiting the resource. Thus there is at most one   */
 /* outgoing edge from each node.                                 */
 /*---------------------------------------------------------------*/
-/* Subscripts 0 to np-1 correspond to processes 0 to np-1.       */
-/* Subscripts np to np+nr-1 correspond to resources 0 to nr-1.   */
+/* Subscripts 0 to np-1 correspond to processes 1 to np.         */
+/* Subscripts np to np+nr-1 correspond to resources 1 to nr.     */
+/*---------------------------------------------------------------*/
+/* The graph is kept up to date as the simulation runs: an edge  */
+/* is added when a process is allocated a resource or is blocked */
+/* waiting for one, and removed when the resource is released or */
+/* the process is taken off the resource's queue.                */
 /*---------------------------------------------------------------*/
 struct node {       /* process/resource node */
     int e;      /* in a process node, e = index of awaited resource */
     /* in a resource node, e = index of owning process */
     /* if no edge exists, then e = -1. */
-    int v;      /* has node been visited yet? */
+};
 
-} prn[MAXPROC+MAXRSRC];
+/*------------------------------------------------------------------*/
+/* The next three arrays are used to record information about the   */
+/* resources. rstate[r] is 0 if resource r is not being used. If    */
+/* resource r is being used by process p, then rstate[r] = p.       */
+/* If there are any processes waiting for the resource, then their  */
+/* process IDs will appear on a queue associated with the resource  */
+/* being awaited. For example, suppose process 3 "owns" resource 4, */
+/* and processes 1 and 2 (in that order) have attempted to gain     */
+/* mutually-exclusive access to the resource. We'd then have this:  */
+/*  rstate[4] = 3       process 3 owns resource 4           */
+/*  rw[4].n = 2     2 procs are waiting for resource 4  */
+/*  rw[4].head = 1      process 1 is first waiting proc     */
+/*  proc.next[1] = 2    process 2 is second waiting proc    */
+/*------------------------------------------------------------------*/
+struct sim {
+    int simno;      /* simulation number */
+    int t;          /* simulation time */
+    int np;         /* total # of processes */
+    int nr;         /* total # of resources */
+
+    struct procs proc;  /* the processes */
+    int pcap;       /* # of entries allocated in each proc array */
+
+    char *act;      /* actions of all processes (L, U or C) */
+    int *val;       /* parameters (resource ID or time) */
+    int nact;       /* # of actions in act and val */
+    int actcap;     /* # of entries allocated for act and val */
+
+    struct queue ready; /* the ready queue */
+    int ncompute;   /* # of ready processes whose next action is C */
+    int noskip;     /* don't look for compute steps to skip before this */
+    int running;    /* ID of the running process (1..np) */
+
+    int *rstate;    /* resource state */
+    /* 0 = unused */
+    /* 1..np = owned by process */
+    struct queue *rw;   /* queues of waiting processes */
+    int rcap;       /* # of entries allocated in rstate and rw */
+
+    struct node *prn;   /* the resource graph */
+    int gcap;       /* # of nodes allocated in prn */
+
+    FILE *out;      /* where the results are written */
+    char *obuf;     /* the results, when written to memory (-j) */
+    size_t olen;    /* # of chars in obuf */
+    int done;       /* non-zero when the simulation has been run */
+    char err[64];   /* error message if it failed, else "" */
+
+    struct trec *tbuf;  /* trace records not yet written (-T) */
+    int tlen;       /* # of records in tbuf */
+    int tcap;       /* # of records allocated in tbuf */
+};
 
 /*-----------------------------------------------*/
 /* Display the state of processes and resources. */
@@ -110,40 +212,45 @@ struct node {       /* process/resource node */
 /* insight into the data structures and the      */
 /* diagnosis of flawed code.                     */
 /*-----------------------------------------------*/
-void statedump(void)
+void statedump(struct sim *sim)
 {
     int i, j;
 
-    printf("State at time %d:\n", t);
-    printf("Processes:\n");
-    for(i=1;i<=np;i++) {
-        printf("    Process %d: ", i);
-        switch(proc[i].state) {
-            case -1: printf("finished\n"); break;
-            case 0: printf("ready/running\n"); break;
-            default: printf("waiting on resource %d\n", proc[i].state); break;
-        }
-    }
-    printf("\nResources:\n");
-    for(i=1;i<=nr;i++) {
-        printf("    Resource %d: ", i);
-        if (rstate[i] == 0)
-            printf("unused\n");
+    fprintf(sim->out,"State at time %d:\n", sim->t);
+    fprintf(sim->out,"Processes:\n");
+    for(i=1;i<=sim->np;i++) {
+        fprintf(sim->out,"    Process %d: ", i);
+        switch(sim->proc.state[i]) {
+            case -1: fprintf(sim->out,"finished\n"); break;
+            case 0: fprintf(sim->out,"ready/running\n"); break;
+            default:
+                fprintf(sim->out,"waiting on resource %d\n",
+                        sim->proc.state[i]);
+                break;
+        }
+    }
+    fprintf(sim->out,"\nResources:\n");
+    for(i=1;i<=sim->nr;i++) {
+        fprintf(sim->out,"    Resource %d: ", i);
+        if (sim->rstate[i] == 0)
+            fprintf(sim->out,"unused\n");
         else {
-            printf("owned by process %d; ", rstate[i]);
-            if (nrw[i] == 0)
-                printf("awaited by no processes.\n");
-            else if (nrw[i] == 1)
-                printf("awaited for by process %d\n", rw[i][0]);
+            fprintf(sim->out,"owned by process %d; ", sim->rstate[i]);
+            if (sim->rw[i].n == 0)
+                fprintf(sim->out,"awaited by no processes.\n");
+            else if (sim->rw[i].n == 1)
+                fprintf(sim->out,"awaited for by process %d\n",
+                        sim->rw[i].head);
             else {
-                printf("awaited for by processes %d", rw[i][0]);
-                for(j=1;j<nrw[i];j++)
-                    printf(", %d", rw[i][j]);
-                putchar('\n');
+                fprintf(sim->out,"awaited for by processes %d",
+                        sim->rw[i].head);
+                for(j=sim->proc.next[sim->rw[i].head];j!=0;j=sim->proc.next[j])
+                    fprintf(sim->out,", %d", j);
+                putc('\n',sim->out);
             }
         }
     }
-    printf("--------------------------------\n");
+    fprintf(sim->out,"--------------------------------\n");
 }
 
 /*-----------------------------------------------*/
@@ -153,20 +260,162 @@ void statedump(void)
 /* data structures and the diagnosis of          */
 /* flawed code.                                  */
 /*-----------------------------------------------*/
-void graphdump(void) {
-    int i, j;
+void graphdump(struct sim *sim) {
+    int i;
+
+    fprintf(sim->out,"Resource graph at time %d:\n", sim->t);
+    fprintf(sim->out,"Processes:\n");
+    for(i=0;i<sim->np;i++) {
+        fprintf(sim->out,"\tProcess %d (e: %d)\n", i+1, sim->prn[i].e);
+    }
 
-    printf("Resource graph at time %d:\n", t);
-    printf("Processes:\n");
-    for(i=0;i<np;i++) {
-        printf("\tProcess %d (e: %d, v: %d)\n", i+1, prn[i].e, prn[i].v);
+    fprintf(sim->out,"Resources:\n");
+    for(i=0;i<sim->nr;i++) {
+        fprintf(sim->out,"\tResource %d (e: %d)\n", i+1, sim->prn[sim->np+i].e);
+    }
+    fprintf(sim->out,"--------------------------------\n");
+}
+
+/*------------------------------------------------------------*/
+/* Return p (from malloc or realloc) resized to n bytes, or    */
+/* give up if there isn't enough memory.                       */
+/*------------------------------------------------------------*/
+void *resize(void *p, size_t n)
+{
+    p = realloc(p,n);
+    if (p == NULL) {
+        fprintf(stderr,"Out of memory.\n");
+        exit(1);
+    }
+    return p;
+}
+
+/*------------------------------------------------------------------*/
+/* Make the process, resource and graph arrays large enough for np  */
+/* processes and nr resources.                                      */
+/*------------------------------------------------------------------*/
+void setsize(struct sim *sim)
+{
+    size_t n;
+
+    if (sim->np + 1 > sim->pcap) {
+        sim->pcap = sim->np + 1;
+        n = sim->pcap * sizeof(int);
+        sim->proc.ns = resize(sim->proc.ns,n);
+        sim->proc.start = resize(sim->proc.start,n);
+        sim->proc.ip = resize(sim->proc.ip,n);
+        sim->proc.state = resize(sim->proc.state,n);
+        sim->proc.runtime = resize(sim->proc.runtime,n);
+        sim->proc.endtime = resize(sim->proc.endtime,n);
+        sim->proc.next = resize(sim->proc.next,n);
+        sim->proc.mark = resize(sim->proc.mark,n);
+    }
+    if (sim->nr + 1 > sim->rcap) {
+        sim->rcap = sim->nr + 1;
+        sim->rstate = resize(sim->rstate,sim->rcap*sizeof(int));
+        sim->rw = resize(sim->rw,sim->rcap*sizeof(struct queue));
+    }
+    if (sim->np + sim->nr > sim->gcap) {
+        sim->gcap = sim->np + sim->nr;
+        sim->prn = resize(sim->prn,sim->gcap*sizeof(struct node));
+    }
+}
+
+/*------------------------------------------------------------------*/
+/* Make room for at least one more action in act and val.           */
+/*------------------------------------------------------------------*/
+void addact(struct sim *sim)
+{
+    if (sim->nact == sim->actcap) {
+        sim->actcap = sim->actcap > 0 ? 2 * sim->actcap : 1024;
+        sim->act = resize(sim->act,sim->actcap);
+        sim->val = resize(sim->val,sim->actcap*sizeof(int));
+    }
+}
+
+/*------------------------------------------------------------------*/
+/* Prepare to read the input data from the named file, or from the  */
+/* standard input if name is NULL.                                  */
+/*------------------------------------------------------------------*/
+void openin(char *name)
+{
+    struct stat st;
+    void *p;
+
+    infd = 0;
+    if (name != NULL) {
+        infd = open(name,O_RDONLY);
+        if (infd == -1) {
+            fprintf(stderr,"Cannot open %s for input.\n", name);
+            exit(1);
+        }
+    }
+    if (fstat(infd,&st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        p = mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,infd,0);
+        if (p != MAP_FAILED) {
+            madvise(p,st.st_size,MADV_SEQUENTIAL);
+            inmapped = 1;
+            inbuf = inp = p;
+            inend = inbuf + st.st_size;
+            return;
+        }
     }
+    inbuf = resize(NULL,INBUF);     /* read it a block at a time */
+    inp = inend = inbuf;
+}
+
+/*-------------------------------------------------------------------*/
+/* Refill inbuf when all of it has been used, and return the next    */
+/* character (as nextc does), or EOF at the end of the input.        */
+/*-------------------------------------------------------------------*/
+int fillin(void)
+{
+    ssize_t n;
+
+    if (inmapped)
+        return EOF;
+    do
+        n = read(infd,inbuf,INBUF);
+    while (n == -1 && errno == EINTR);
+    if (n <= 0)
+        return EOF;
+    inp = inbuf;
+    inend = inbuf + n;
+    return (unsigned char)*inp++;
+}
 
-    printf("Resources:\n");
-    for(i=0;i<nr;i++) {
-        printf("\tResource %d (e: %d, v: %d)\n", i+1, prn[MAXRSRC+i].e, prn[MAXRSRC+i].v);
+/*-------------------------------------------------------------------*/
+/* Read an integer, after skipping white space, into *v. Return 1 if */
+/* one was read, or 0 if the next input isn't an integer (like       */
+/* fscanf with "%d"). The character after the integer isn't used.    */
+/*-------------------------------------------------------------------*/
+int getint(int *v)
+{
+    int c, neg;
+    unsigned u;
+
+    c = nextc();
+    while (isspace(c))
+        c = nextc();
+    neg = 0;
+    if (c == '-' || c == '+') {
+        neg = c == '-';
+        c = nextc();
+    }
+    if (!isdigit(c)) {
+        if (c != EOF)
+            inp--;
+        return 0;
     }
-    printf("--------------------------------\n");
+    u = 0;
+    while (isdigit(c)) {
+        u = u * 10 + c - '0';
+        c = nextc();
+    }
+    if (c != EOF)
+        inp--;
+    *v = neg ? -(int)u : (int)u;
+    return 1;
 }
 
 /*---------------------------------------------------------------------------*/
@@ -178,88 +427,105 @@ void graphdump(void) {
 /* for your use, there probably isn't much reason to change it. Obviously,   */
 /* you should verify you understand what it's doing!                         */
 /*---------------------------------------------------------------------------*/
-int getinput(void)
+int getinput(struct sim *sim)
 {
     int i, j;
-    int r;              /* fscanf result */
+    int r;              /* getint result */
     int c;              /* an action letter (L, U, or C) */
     int v;              /* value for the action */
     int oldv;               /* used for overflow test */
     int got1;               /* did we get at least one digit? */
+    int k;              /* index in act and val of the action */
 
-    r = fscanf(f,"%d%d",&np,&nr);   /* # processes, # resources */
+    r = getint(&sim->np);       /* # processes, # resources */
+    if (r == 1)
+        r += getint(&sim->nr);
     if (r != 2) {
-        fprintf(stderr,"Error reading np and nr.\n");
+        fprintf(errout,"Error reading np and nr.\n");
         return -1;
     }
 
-    if (np == 0 && nr== 0) return 0;    /* end of input? */
+    if (sim->np == 0 && sim->nr== 0) return 0;    /* end of input? */
+
+    if (sim->np < 0 || sim->nr < 0) {
+        fprintf(errout,"Bad number of processes or resources.\n");
+        return -1;
+    }
+    setsize(sim);
+    sim->nact = 0;
 
-    for (i=1;i<=np;i++) {       /* get data for processes 1 ... np */
-        r = fscanf(f,"%d",&proc[i].ns); /* # of steps for process i */
+    for (i=1;i<=sim->np;i++) {       /* get data for processes 1 ... np */
+        r = getint(&sim->proc.ns[i]);    /* # of steps for process i */
         if (r != 1) {
-            fprintf(stderr,"Error reading number of actions for process %d\n",
+            fprintf(errout,"Error reading number of actions for process %d\n",
                     i);
             return -1;
         }
+        if (sim->proc.ns[i] < 1) {
+            fprintf(errout,"Bad number of actions for process %d\n", i);
+            return -1;
+        }
+        sim->proc.start[i] = sim->nact;
 
-        c = fgetc(f);
-        for (j=0;j<proc[i].ns;j++) {        /* get action steps */
+        c = nextc();
+        for (j=0;j<sim->proc.ns[i];j++) {        /* get action steps */
             while (c == ' ' || c == '\t')   /* skip blanks and tabs */
-                c = fgetc(f);
+                c = nextc();
             if (c != 'L' && c != 'U' && c != 'C') {
-                fprintf(stderr,"Bad action for process %d step %d.\n", i, j);
+                fprintf(errout,"Bad action for process %d step %d.\n", i, j);
                 return -1;
             }
-            proc[i].a[j] = c;           /* save action for step j */
+            addact(sim);
+            k = sim->nact++;
+            sim->act[k] = c;             /* save action for step j */
 
             got1 = 0;               /* we've got no digits yet */
             v = 0;
-            c = fgetc(f);
+            c = nextc();
             while(isdigit(c)) {
                 got1 = 1;
                 oldv = v;
                 v = v * 10 + c - '0';
                 if ((v - c + '0') / 10 != oldv) {
-                    fprintf(stderr,
+                    fprintf(errout,
                             "Overflow reading n for process %d step %d.\n",
                             i, j);
                     return -1;
                 }
-                c = fgetc(f);
+                c = nextc();
             }
             if (!got1) {
-                fprintf(stderr,"Missing value for process %d step %d\n", i, j);
+                fprintf(errout,"Missing value for process %d step %d\n", i, j);
                 return -1;
             }
-            proc[i].n[j] = v;
-            switch(proc[i].a[j]) {
+            sim->val[k] = v;
+            switch(sim->act[k]) {
                 case 'L':
                 case 'U':
-                    if (proc[i].n[j] < 1 || proc[i].n[j] > nr) {
-                        fprintf(stderr,"Bad value for process %d "
+                    if (sim->val[k] < 1 || sim->val[k] > sim->nr) {
+                        fprintf(errout,"Bad value for process %d "
                                 "step %d.\n", i, j);
                         return -1;
                     }
                     break;
                 case 'C':
-                    if (proc[i].n[j] < 1) {
-                        fprintf(stderr,"Bad value for process %d "
+                    if (sim->val[k] < 1) {
+                        fprintf(errout,"Bad value for process %d "
                                 "step %d.\n", i, j);
                         return -1;
                     }
                     break;
                 default:    /* this should not be possible */
-                    fprintf(stderr,"Unrecognized action character for "
+                    fprintf(errout,"Unrecognized action character for "
                             "process %d step %d.\n", i, j);
                     return -1;
             }
         }
 
         while (c == ' ' || c == '\t')   /* skip trailing blanks, tabs */
-            c = fgetc(f);
+            c = nextc();
         if (c != '\n') {
-            fprintf(stderr,"Unrecognized input after actions for "
+            fprintf(errout,"Unrecognized input after actions for "
                     "process %d.\n", i);
             return -1;
         }
@@ -268,87 +534,71 @@ int getinput(void)
 }
 
 /*-------------------------------------------------------------------*/
-/* Deadlock detection algorithm.                                     */
-/* See if deadlock exists in the current state.                      */
-/*                                                                   */
-/* If deadlock is detected, display the appropriate information (the */
-/* identity of the processes and resources involved) and return 1.   */
-/*                                                                   */
-/* If deadlock is not detected, return 0.                            */
+/* Cycle detection. Return 1 if process s is in a cycle in the       */
+/* resource graph, and 0 otherwise.                                  */
 /*-------------------------------------------------------------------*/
-/* The argument s is the subscript of the node in the resource graph */
-/* with which the cycle detection algorithm begins.                  */
+/* The argument s is the subscript + 1 of the process node with      */
+/* which the search begins. The search just follows the edges from   */
+/* s (there is at most one edge out of each node) until it gets back */
+/* to s, or to a node without an edge. It can't get into a cycle     */
+/* that doesn't include s, since the graph is checked every time an  */
+/* edge that could complete a cycle is added, and the simulation     */
+/* stops when a cycle is found. So the cost is just the length of    */
+/* the chain of waiting processes that starts at s.                  */
 /*-------------------------------------------------------------------*/
 /* HIGHLY RECOMMENDED: READ THE FILE NAMED 'cycle.txt' in the        */
 /* csci4500 directory on Loki. Make certain you understand how the   */
 /* algorithm works before attempting to implement it!                */
 /*-------------------------------------------------------------------*/
-int cycle(int s)
+int cycle(struct sim *sim, int s)
 {
-    int i, p, isRes;
-
-    /* Mark all nodes in graph as not visited */
-    for (i = 0; i < np; i++) {
-        prn[i].v = 0;
-    }
-    for (i = 0; i < nr; i++) {
-        prn[MAXPROC + i].v = 0;
-    }
+    int p, isRes;
 
-    prn[s-1].v = 1;
     p = s;
     isRes = 0;
 
     for (;;) {
         if (isRes) {
-            p = prn[p-1].e;
+            p = sim->prn[p-1].e;
             isRes = 0;
         } else {
-            if (prn[p-1].e == -1) {
+            if (sim->prn[p-1].e == -1) {
                 p = -1;
             } else {
-                p = prn[p - 1].e + MAXPROC;
+                p = sim->prn[p - 1].e + sim->np;
             }
             isRes = 1;
         }
 
-        /* No more edges, continue search from next process node */
-        if (p == -1) break;
+        /* No more edges, so no cycle */
+        if (p == -1) return 0;
 
         /* Cycle found, starting with process s */
         if (p == s) return 1;
-
-        /* Cycle found, but didn't start with process s, */
-        /* continue search from next process node */
-        if (prn[p-1].v == 1) break;
-
-        prn[p-1].v = 1;
     }
-
-    return 0;
 }
 
 /*---------------------------------------------------------*/
 /* Display IDs of processes in cycle starting with node s. */
 /*---------------------------------------------------------*/
-void putpcycle(int s)
+void putpcycle(struct sim *sim, int s)
 {
     int p, isRes;
 
     p = s;
     isRes = 0;
 
-    printf("\tProcesses %d", p);
+    fprintf(sim->out,"\tProcesses %d", p);
 
     for (;;) {
         if (isRes) {
-            p = prn[p-1].e;
+            p = sim->prn[p-1].e;
             isRes = 0;
         } else {
-            if (prn[p-1].e == -1) {
+            if (sim->prn[p-1].e == -1) {
                 p = -1;
             } else {
-                p = prn[p - 1].e + MAXPROC;
+                p = sim->prn[p - 1].e + sim->np;
             }
             isRes = 1;
         }
@@ -357,131 +607,644 @@ void putpcycle(int s)
         if (p == s) break;
 
         if (!isRes) {
-            printf(", %d", p);
+            fprintf(sim->out,", %d", p);
         }
     }
-    putchar('\n');
+    putc('\n',sim->out);
 }
 
 /*---------------------------------------------------------*/
 /* Display IDs of resources in cycle starting with node s. */
 /*---------------------------------------------------------*/
-void putrcycle(int s)
+void putrcycle(struct sim *sim, int s)
 {
     int r, isRes;
 
-    r = prn[s-1].e + MAXPROC;
+    r = sim->prn[s-1].e + sim->np;
     isRes = 1;
 
-    printf("\tResources %d", r - MAXPROC);
+    fprintf(sim->out,"\tResources %d", r - sim->np);
 
     for (;;) {
         if (isRes) {
-            r = prn[r-1].e;
+            r = sim->prn[r-1].e;
             isRes = 0;
         } else {
-            if (prn[r-1].e == -1) {
+            if (sim->prn[r-1].e == -1) {
                 r = -1;
             } else {
-                r = prn[r - 1].e + MAXPROC;
+                r = sim->prn[r - 1].e + sim->np;
             }
             isRes = 1;
         }
 
         /* Reached starting process, all cycles displayed */
-        if (r == prn[s-1].e + MAXPROC) break;
+        if (r == sim->prn[s-1].e + sim->np) break;
 
         if (isRes) {
-            printf(", %d", r - MAXPROC);
+            fprintf(sim->out,", %d", r - sim->np);
         }
     }
-    putchar('\n');
+    putc('\n',sim->out);
+}
+
+/*------------------------------------------------------------------*/
+/* Return the process that process p is waiting for (the owner of   */
+/* the resource it's blocked on), or 0 if p isn't blocked.          */
+/*------------------------------------------------------------------*/
+int waitsfor(struct sim *sim, int p)
+{
+    if (sim->prn[p-1].e == -1)
+        return 0;
+    return sim->rstate[sim->prn[p-1].e];
+}
+
+/*------------------------------------------------------------------*/
+/* Values of proc.mark[p] in putdead.                               */
+/*------------------------------------------------------------------*/
+#define UNSEEN 0    /* not visited yet */
+#define ONPATH 1    /* on the chain being followed */
+#define LIVE 2      /* not deadlocked */
+#define BEHIND 3    /* waiting (directly or not) for a deadlocked proc */
+#define INCYCLE 4   /* in a cycle */
+#define CYCLEMIN 5  /* the lowest-numbered process in a cycle */
+
+/*------------------------------------------------------------------*/
+/* Display every deadlock: the processes and resources in each      */
+/* cycle of the resource graph, and then the processes that are     */
+/* blocked behind one (waiting, directly or not, for a process in   */
+/* a cycle), since they can't finish either.                        */
+/*------------------------------------------------------------------*/
+/* Every node has at most one edge out of it, so each strongly      */
+/* connected component with more than one node is just a cycle,     */
+/* and one pass finds them all, in O(np + nr) time: the chain of    */
+/* waiting processes from each process not yet visited is followed  */
+/* until it reaches a process that's been visited, or one that      */
+/* isn't blocked. If it gets back to a process on the same chain,   */
+/* there's a new cycle. Then the processes on the chain are marked  */
+/* as deadlocked or not, depending on where the chain ended.        */
+/*------------------------------------------------------------------*/
+/* The cycles are displayed in the order of their lowest-numbered   */
+/* processes, each starting with that process.                      */
+/*------------------------------------------------------------------*/
+void putdead(struct sim *sim)
+{
+    int i, p, q, s, dead, n;
+    int *mark = sim->proc.mark;
+
+    for (i=1;i<=sim->np;i++)
+        mark[i] = UNSEEN;
+
+    for (i=1;i<=sim->np;i++) {
+        if (mark[i] != UNSEEN)
+            continue;
+        for (p=i;p!=0&&mark[p]==UNSEEN;p=waitsfor(sim, p))
+            mark[p] = ONPATH;
+        if (p != 0 && mark[p] == ONPATH) {  /* a new cycle */
+            s = p;
+            q = p;
+            do {
+                mark[q] = INCYCLE;
+                if (q < s)
+                    s = q;
+                q = waitsfor(sim, q);
+            } while (q != p);
+            mark[s] = CYCLEMIN;
+        }
+        dead = p != 0 && mark[p] != LIVE;
+        for (p=i;p!=0&&mark[p]==ONPATH;p=waitsfor(sim, p))
+            mark[p] = dead ? BEHIND : LIVE;
+    }
+
+    for (i=1;i<=sim->np;i++) {
+        if (mark[i] == CYCLEMIN) {
+            putpcycle(sim, i);
+            putrcycle(sim, i);
+        }
+    }
+    n = 0;
+    for (i=1;i<=sim->np;i++) {
+        if (mark[i] == BEHIND) {
+            if (n++ == 0)
+                fprintf(sim->out,"\tBlocked behind the deadlock: "
+                        "processes %d", i);
+            else
+                fprintf(sim->out,", %d", i);
+        }
+    }
+    if (n > 0)
+        putc('\n',sim->out);
 }
 
 /*----------------------------------------------------------------*/
-/* Build a resource graph representing the current system state.  */
-/* Then check for a deadlock starting with each process node.     */
+/* Check for a deadlock involving process p, which has just been  */
+/* blocked waiting for a resource. A deadlock can only be created */
+/* when a process blocks (that is the only time an edge out of a  */
+/* process node is added), and then only one that includes that   */
+/* process, so there's no need to look anywhere else.             */
 /*                                                                */
-/* If a deadlock is detected, display the processes and resources */
-/* involved in the deadlock and return any non-zero value.        */
+/* If a deadlock is detected, display every deadlocked process    */
+/* and the resources involved (see putdead), and return any       */
+/* non-zero value.                                                */
 /*                                                                */
 /* If *NO* deadlock is detected, return 0.                        */
 /*----------------------------------------------------------------*/
-/* Note that a solution might choose to keep the resource graph   */
-/* "up to date" as the simulation of the processes continues.     */
-/* That approach would likely be faster than rebuilding the graph */
-/* after each action, but we're not concerned with speed here.    */
-/* And this approach is less likely to have errors...             */
-/*----------------------------------------------------------------*/
-int deadlock(void)
+int deadlock(struct sim *sim, int p)
+{
+    if (!cycle(sim, p))
+        return 0;           /* report no deadlock detected */
+
+    fprintf(sim->out,"Deadlock detected at time %d involving...\n", sim->t);
+    putdead(sim);
+    return 1;               /* report deadlock detected */
+}
+
+/*------------------------------------------------*/
+/* Add process p (1..np) to the end of queue q.   */
+/*------------------------------------------------*/
+void enqueue(struct sim *sim, struct queue *q, int p)
+{
+    sim->proc.next[p] = 0;
+    if (q->head == 0)
+        q->head = p;
+    else
+        sim->proc.next[q->tail] = p;
+    q->tail = p;
+    q->n++;
+}
+
+/*---------------------------------------------------------*/
+/* Remove the first process from queue q and return it, or */
+/* return 0 if the queue is empty.                         */
+/*---------------------------------------------------------*/
+int dequeue(struct sim *sim, struct queue *q)
+{
+    int p;
+
+    p = q->head;
+    if (p != 0) {
+        q->head = sim->proc.next[p];
+        q->n--;
+    }
+    return p;
+}
+
+/*-----------------------------------------------------*/
+/* Add process p (1..np) to the end of the ready queue */
+/*-----------------------------------------------------*/
+void makeready(struct sim *sim, int p)
+{
+    enqueue(sim, &sim->ready,p);
+    if (sim->act[sim->proc.start[p]+sim->proc.ip[p]] == 'C')
+        sim->ncompute++;
+}
+
+/*--------------------------------------------------*/
+/* Add process p (1..np) to the end of the queue of */
+/* processes waiting on resource r (1..nr)          */
+/*--------------------------------------------------*/
+void makewait(struct sim *sim, int p, int r)
 {
-    int i, j, n;
-    int dproc[MAXPROC];     /* IDs of processes involved in a deadlock */
-    int ndproc;
-    int drsrc[MAXRSRC];     /* IDs of resources involved in a deadlock */
-    int ndrsrc;
+    enqueue(sim, &sim->rw[r],p);
+}
 
-    /*-------------------------------*/
-    /* Construct the resource graph. */
-    /*-------------------------------*/
+/*------------------------------------------------------------------*/
+/* Skip ahead over compute steps. This is called when the running   */
+/* process is about to take one step of a C action with n steps     */
+/* left, and every process on the ready queue is also in the middle */
+/* of a C action. Until one of them gets to the last step of its C  */
+/* action, nothing can happen but each of them taking one more step */
+/* in turn, always in the same order, so if m is the fewest steps   */
+/* any of them has left, m-1 such rounds are done at once: each     */
+/* process's C action and run time change by m-1, and the time by   */
+/* m-1 times the number of processes. The remaining steps are then  */
+/* simulated one at a time as usual, so the results are exactly the */
+/* same. Return the number of steps the running process has left.   */
+/*------------------------------------------------------------------*/
+/* If some process has just one step left, nothing is skipped, and  */
+/* the ready queue isn't scanned again for a round, so the scans    */
+/* cost at most a constant per simulated step.                      */
+/*------------------------------------------------------------------*/
+int skip(struct sim *sim, int n)
+{
+    int m, p;
+
+    m = n;          /* fewest steps left in any ready process */
+    for (p=sim->ready.head;p!=0 && m>1;p=sim->proc.next[p])
+        if (sim->val[sim->proc.start[p]+sim->proc.ip[p]] < m)
+            m = sim->val[sim->proc.start[p]+sim->proc.ip[p]];
+    if (m <= 1) {
+        sim->noskip = sim->t + sim->ready.n + 1;
+        return n;
+    }
 
-    /* Initialize the resource graph */
-    for (i=0;i<np;i++) {
-        prn[i].e = -1;
-        prn[i].v = 0;
+    m--;            /* # of rounds to skip */
+    for (p=sim->ready.head;p!=0;p=sim->proc.next[p]) {
+        sim->val[sim->proc.start[p]+sim->proc.ip[p]] -= m;
+        sim->proc.runtime[p] += m;
     }
-    for (i=0;i<nr;i++) {
-        prn[MAXPROC+i].e = -1;
-        prn[MAXPROC+i].v = 0;
+    sim->proc.runtime[sim->running] += m;
+    sim->t += (sim->ready.n + 1) * m;
+    return n - m;
+}
+
+
+/*-------------------------------------------------------------*/
+/* Write the trace records in sim->tbuf to the trace file.      */
+/*-------------------------------------------------------------*/
+void tflush(struct sim *sim)
+{
+    char *b = (char *)sim->tbuf;
+    size_t n = sim->tlen * sizeof(struct trec);
+    ssize_t w;
+
+    while (n > 0) {
+        w = write(tfd,b,n);
+        if (w == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("trace file");
+            exit(1);
+        }
+        b += w;
+        n -= w;
+    }
+    sim->tlen = 0;
+}
+
+/*-------------------------------------------------------------------*/
+/* Record an event: display it (with -v), and add a record for it to */
+/* the trace buffer (with -T). Without -j the buffer is written when */
+/* it's full; with -j it is kept until the results are written.      */
+/*-------------------------------------------------------------------*/
+void note(struct sim *sim, int kind, int p, int a, int v)
+{
+    struct trec *r;
+    int n;
+
+    if (trace) {
+        switch (kind) {
+            case TSTEP:
+                fprintf(sim->out,"%d: process %d: %c%d\n", sim->t, p, a, v);
+                break;
+            case TALLOC:
+                fprintf(sim->out,"\t(resource %d allocated to process %d)\n",
+                        v, p);
+                break;
+            case TUNAVAIL:
+                fprintf(sim->out,"\t(resource %d unavailable)\n", v);
+                break;
+            case TRELEASE:
+                fprintf(sim->out,"\t(resource %d released)\n", v);
+                break;
+            case TUNBLOCK:
+                fprintf(sim->out,"\t(process %d unblocked)\n", p);
+                break;
+            case TTERM:
+                fprintf(sim->out,"\t(process %d terminated)\n", p);
+                break;
+        }
     }
-    /* Add edges from allocated resources to owning processes */
-    for (i=1;i<nr+1;i++) {
-        n = rstate[i];
-        if (n > 0) {
-            prn[MAXPROC+i-1].e = n;
+    if (tfd == -1)
+        return;
+    if (sim->tlen == sim->tcap) {
+        if (njobs == 0 && sim->tcap > 0)
+            tflush(sim);
+        else {                  /* a worker can't exit */
+            n = sim->tcap > 0 ? 2 * sim->tcap : TBUF;
+            r = realloc(sim->tbuf,n*sizeof(struct trec));
+            if (r == NULL) {
+                strcpy(sim->err,"Out of memory.\n");
+                return;
+            }
+            sim->tbuf = r;
+            sim->tcap = n;
         }
     }
-    /* Add edges from blocked processes to requested resources */
-    for (i=1;i<nr+1;i++) {
-        if (nrw[i] == 0) continue;
+    r = &sim->tbuf[sim->tlen++];
+    r->t = sim->t;
+    r->p = p;
+    r->v = v;
+    r->kind = kind;
+    r->a = a;
+    r->pad[0] = r->pad[1] = 0;
+}
 
-        for (j=0;j<nrw[i];j++) {
-            n = rw[i][j];
-            prn[n-1].e = i;
+/*---------------------------------------------------------------*/
+/* Run the simulation whose input data is in sim, writing the    */
+/* results to sim->out. Return 0, or -1 if it failed, with the   */
+/* error message in sim->err (it may be run by a worker thread,  */
+/* which mustn't exit).                                          */
+/*---------------------------------------------------------------*/
+int simulate(struct sim *sim)
+{
+    int i, ip, n;
+    int dd;             /* non-zero if deadlock detected */
+    char a;
+
+    sim->t = 0;              /* set simulation time */
+
+    /*---------------------------------*/
+    /* Initialize the data structures. */
+    /*---------------------------------*/
+    memset(&sim->ready,0,sizeof(sim->ready));
+    sim->ncompute = sim->noskip = 0;
+    for (i=1;i<=sim->np;i++) {       /* initialize each process */
+        sim->proc.ip[i] = 0;         /* first action index */
+        sim->proc.state[i] = 0;          /* process state is ready */
+        sim->proc.runtime[i] = 0;        /* no time used yet */
+        makeready(sim, i);           /* setup initial ready queue */
+        sim->prn[i-1].e = -1;            /* no edges in the graph */
+    }
+
+    for (i=1;i<=sim->nr;i++) {       /* initialize each resource */
+        sim->rstate[i] = 0;          /* unused */
+        memset(&sim->rw[i],0,sizeof(sim->rw[i])); /* no waiting procs */
+        sim->prn[sim->np+i-1].e = -1;
+    }
+    dd = 0;
+
+    fprintf(sim->out,"Simulation %d\n", sim->simno);
+    if (logsteps)
+        note(sim, TSIM, sim->simno, 0, 0);
+
+    /*-----------------------------------------------------------*/
+    /* Simulate process actions until all processes are done or  */
+    /* deadlock is detected.                                     */
+    /*-----------------------------------------------------------*/
+    for(;;) {
+        /*---------------------------------------------*/
+        /* Get a process from the ready queue to run.  */
+        /* If there are no ready processes, we must be */
+        /* done or deadlocked.                         */
+        /*---------------------------------------------*/
+        if (sim->err[0] != '\0')
+            return -1;
+        sim->running = dequeue(sim, &sim->ready); /* first ready process */
+        if (sim->running == 0) break;        /* no ready processes */
+
+        /*--------------------------------------*/
+        /* Get ip, a, and n for running process */
+        /*--------------------------------------*/
+        ip = sim->proc.ip[sim->running];
+        a = sim->act[sim->proc.start[sim->running]+ip];
+        n = sim->val[sim->proc.start[sim->running]+ip];
+        if (a == 'C')
+            sim->ncompute--;         /* it's no longer on the queue */
+
+        if (logsteps)
+            note(sim, TSTEP, sim->running, a, n);
+
+        /*--------------------------------------------*/
+        /* If the process is requesting a resource... */
+        /*--------------------------------------------*/
+        if (a == 'L') {
+            /*------------------------------*/
+            /* If the resource is available */
+            /*------------------------------*/
+            if (sim->rstate[n] == 0) {
+                if (logsteps)
+                    note(sim, TALLOC, sim->running, 0, n);
+
+                /* allocate resource to process */
+                sim->rstate[n] = sim->running;
+                sim->prn[sim->np+n-1].e = sim->running;
+
+                /* increment process runtime */
+                sim->proc.runtime[sim->running]++;
+                if (ip+1 == sim->proc.ns[sim->running]) {
+                    /* its last action: done, still holding n */
+                    sim->proc.state[sim->running] = -1;
+                    sim->proc.endtime[sim->running] = sim->t+1;
+                    if (logsteps)
+                        note(sim, TTERM, sim->running, 0, 0);
+                } else {
+                    sim->proc.ip[sim->running]++;
+                    makeready(sim, sim->running);
+                }
+                sim->t++;
+
+            /*-----------------------------------*/
+            /* If the resource is not available. */
+            /* Time does NOT increase here!      */
+            /*-----------------------------------*/
+            } else {
+                if (logsteps)
+                    note(sim, TUNAVAIL, 0, 0, n);
+                makewait(sim, sim->running,n);    /* add to waiters */
+                sim->proc.state[sim->running] = n; /* mark proc blocked */
+                sim->prn[sim->running-1].e = n;
+
+                dd = deadlock(sim, sim->running); /* check for deadlock */
+                if (dd)         /* if it was detected */
+                    break;
+            }
+        }
+
+        /*-------------------------------------------*/
+        /* If the process is releasing a resource... */
+        /*-------------------------------------------*/
+        else if (a == 'U') {
+            sim->rstate[n] = 0;      /* resource unused now */
+            sim->prn[sim->np+n-1].e = -1;
+            if (logsteps)
+                note(sim, TRELEASE, 0, 0, n);
+
+            /*---------------------------------------------*/
+            /* If any processes are waiting on the resource */
+            /*---------------------------------------------*/
+            if (sim->rw[n].n > 0) {
+                if (logsteps)
+                    note(sim, TUNBLOCK, sim->rw[n].head, 0, 0);
+
+                /* remove first waiting process from resource queue */
+                /* and make it ready */
+                i = dequeue(sim, &sim->rw[n]);
+                sim->prn[i-1].e = -1;
+                makeready(sim, i);
+            }
+
+            /*----------------------------------------*/
+            /* The currently running process advances */
+            /*----------------------------------------*/
+            if (ip+1 == sim->proc.ns[sim->running]) {
+                sim->proc.state[sim->running] = -1;       /* done */
+                sim->proc.endtime[sim->running] = sim->t+1; /* end time */
+                if (logsteps)
+                    note(sim, TTERM, sim->running, 0, 0);
+            } else {
+                sim->proc.ip[sim->running]++;
+                makeready(sim, sim->running);
+            }
+            sim->proc.runtime[sim->running]++;
+            sim->t++;
+        }
+
+        /*-------------------------------*/
+        /* If the process is "computing" */
+        /*-------------------------------*/
+        else if (a == 'C') {
+            /*------------------------------------------------*/
+            /* If every ready process is computing, skip the  */
+            /* steps that can't change anything. The trace    */
+            /* has every step, so nothing is skipped then.    */
+            /*------------------------------------------------*/
+            if (!logsteps && n > 1 && sim->ncompute == sim->ready.n
+                && sim->t >= sim->noskip)
+                n = skip(sim, n);
+
+            n--; /* reduce remaining computation time */
+
+            /*----------------------------------------*/
+            /* The currently running process advances */
+            /*----------------------------------------*/
+            if (n == 0 && ip+1 == sim->proc.ns[sim->running]) {
+                sim->proc.state[sim->running] = -1;       /* done */
+                sim->proc.endtime[sim->running] = sim->t+1; /* end time */
+                if (logsteps)
+                    note(sim, TTERM, sim->running, 0, 0);
+            } else {
+                if (n == 0) {
+                    sim->proc.ip[sim->running]++;
+                } else {
+                    sim->val[sim->proc.start[sim->running]+ip] = n;
+                }
+                makeready(sim, sim->running);
+            }
+            sim->proc.runtime[sim->running]++;
+            sim->t++;
+        }
+
+        /*----------------------------------------------------------*/
+        /* This point should never be reached if the data is valid. */
+        /*----------------------------------------------------------*/
+        else {
+            sprintf(sim->err,"Bad action (%d)\n", a);
+            return -1;
         }
     }
 
-    /*-----------------------------------------------------------------*/
-    /* Check for a cycle starting at every process node in the graph.  */
-    /*-----------------------------------------------------------------*/
-    for(i=0;i<np;i++)
-        /* Check for cycle and display involved nodes if found */
-        if (cycle(i+1)) {
-            printf("Deadlock detected at time %d involving...\n", t);
-            putpcycle(i+1);
-            putrcycle(i+1);
-            return 1;       /* report deadlock detected */
+    if (!dd) {
+        /*----------------*/
+        /* If no deadlock */
+        /*----------------*/
+        fprintf(sim->out,"All processes successfully terminated.\n");
+        for (i=1;i<=sim->np;i++) {
+            fprintf(sim->out,"Process %d: run time = %d, ended at %d\n",
+                   i, sim->proc.runtime[i], sim->proc.endtime[i]);
         }
+    }
 
-    return 0;           /* report no deadlock detected */
+    putc('\n',sim->out);
+    return 0;
 }
 
-/*-----------------------------------------------------*/
-/* Add process p (1..np) to the end of the ready queue */
-/*-----------------------------------------------------*/
-void makeready(int p)
+/*------------------------------------------------------------------*/
+/* With -j, the main thread reads the simulations and njobs worker  */
+/* threads run them. Simulation k is kept in slot[k % nslot], and   */
+/* each worker writes its results to memory; the main thread writes */
+/* them to the standard output in order, as soon as all earlier     */
+/* ones have been written. The slot of simulation k is not used for */
+/* simulation k+nslot until the results of simulation k have been   */
+/* written, so at most nslot simulations are in memory at a time.   */
+/* If a simulation fails, the worker only records the error; the    */
+/* main thread displays it after the results of the simulations     */
+/* before it, and exits.                                            */
+/*------------------------------------------------------------------*/
+int nslot;              /* # of simulations in memory at a time */
+struct sim **slot;      /* the simulations */
+int nread;              /* # of simulations read */
+int nrun;               /* # of simulations taken by the workers */
+int nout;               /* # of simulations written */
+int eof;                /* non-zero at end of input */
+int failed;             /* non-zero after a simulation failed */
+pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t change = PTHREAD_COND_INITIALIZER;
+
+/*-------------------------------------------------------------*/
+/* Worker thread: run simulations until the input is all used. */
+/*-------------------------------------------------------------*/
+void *worker(void *arg)
+{
+    struct sim *sim;
+
+    (void)arg;
+    pthread_mutex_lock(&lock);
+    for (;;) {
+        while (nrun == nread && !eof)
+            pthread_cond_wait(&change,&lock);
+        if (nrun == nread)
+            break;
+        sim = slot[++nrun % nslot];
+        pthread_mutex_unlock(&lock);
+
+        sim->err[0] = '\0';
+        sim->out = open_memstream(&sim->obuf,&sim->olen);
+        if (sim->out == NULL)
+            strcpy(sim->err,"Out of memory.\n");
+        else {
+            simulate(sim);
+            fclose(sim->out);
+        }
+
+        pthread_mutex_lock(&lock);
+        sim->done = 1;
+        pthread_cond_broadcast(&change);
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+/*---------------------------------------------------------------*/
+/* Write the results of the next simulation to the standard      */
+/* output, waiting for them if wait is non-zero. Return 0 if the */
+/* results were not ready (or there are no more simulations),    */
+/* or -1 if the simulation failed (after displaying the error).  */
+/*---------------------------------------------------------------*/
+int putnext(int wait)
 {
-    ready[nready++] = p;
+    struct sim *sim;
+
+    pthread_mutex_lock(&lock);
+    sim = slot[(nout+1) % nslot];
+    while (wait && nout < nread && !sim->done)
+        pthread_cond_wait(&change,&lock);
+    if (nout == nread || !sim->done) {
+        pthread_mutex_unlock(&lock);
+        return 0;
+    }
+    pthread_mutex_unlock(&lock);
+
+    if (sim->obuf != NULL)
+        fwrite(sim->obuf,1,sim->olen,stdout);
+    if (tfd != -1)
+        tflush(sim);
+    free(sim->obuf);
+    sim->obuf = NULL;
+    sim->done = 0;
+    nout++;
+    if (sim->err[0] != '\0') {
+        fflush(stdout);
+        fputs(sim->err,stderr);
+        failed = 1;
+        return -1;
+    }
+    return 1;
 }
 
-/*--------------------------------------------------*/
-/* Add process p (1..np) to the end of the queue of */
-/* processes waiting on resource r (1..nr)          */
-/*--------------------------------------------------*/
-void makewait(int p, int r)
+/*---------------------------------------------------------------*/
+/* Write the results of all the simulations that have been read. */
+/* This is also done when the program exits because of an error  */
+/* in the input, so what was written before the bad simulation   */
+/* is the same as without -j. Nothing more is written after a     */
+/* simulation has failed.                                        */
+/*---------------------------------------------------------------*/
+void putall(void)
 {
-    rw[r][nrw[r]] = p;
-    nrw[r]++;
+    if (!failed)
+        while (putnext(1) > 0)
+            ;
+    fflush(stdout);
 }
 
 /*---------------------------------------------------------------*/
@@ -490,9 +1253,11 @@ void makewait(int p, int r)
 /*---------------------------------------------------------------*/
 int main(int argc, char *argv[])
 {
-    int i, ip, n;
-    int dd;             /* non-zero if deadlock detected */
-    char a;
+    int i;
+    struct sim *sim;
+    pthread_t *tid;
+    char *ebuf;             /* input error message (-j) */
+    size_t elen;
 
     /*-----------------*/
     /* Handle options. */
@@ -504,194 +1269,130 @@ int main(int argc, char *argv[])
             argv++;
             continue;
         }
+        if (!strcmp(argv[1],"-T") && argc > 2) {
+            tfd = open(argv[2],O_WRONLY|O_CREAT|O_TRUNC,0666);
+            if (tfd == -1 || write(tfd,TMAGIC,8) != 8) {
+                fprintf(stderr,"Cannot create trace file %s.\n", argv[2]);
+                exit(1);
+            }
+            argc -= 2;
+            argv += 2;
+            continue;
+        }
+        if (!strcmp(argv[1],"-j") && argc > 2) {
+            njobs = atoi(argv[2]);
+            if (njobs < 1) {
+                fprintf(stderr,"Bad number of jobs %s\n", argv[2]);
+                exit(1);
+            }
+            argc -= 2;
+            argv += 2;
+            continue;
+        }
         fprintf(stderr,"Unknown option %s\n", argv[1]);
         exit(1);
     }
 
-    /*------------------------------------*/
-    /* Setup stream f for the input data. */
-    /*------------------------------------*/
+    /*---------------------------------*/
+    /* Setup input from file or stdin. */
+    /*---------------------------------*/
     if (argc > 2) {
-        fprintf(stderr,"Usage: prog2 [-v] [inputfilename]\n");
+        fprintf(stderr,"Usage: prog2 [-v] [-T tracefile] [-j N] "
+                "[inputfilename]\n");
+        exit(1);
+    }
+    openin(argc == 2 ? argv[1] : NULL);
+
+    /*--------------------------------------------------------*/
+    /* An error in the input is displayed after the results   */
+    /* of the simulations before it (which may still be in a  */
+    /* buffer, or being run), so it's kept until then.        */
+    /*--------------------------------------------------------*/
+    errout = open_memstream(&ebuf,&elen);
+    if (errout == NULL) {
+        fprintf(stderr,"Out of memory.\n");
         exit(1);
     }
-    if (argc == 2) {
-        f = fopen(argv[1],"r");
-        if (f == NULL) {
-            fprintf(stderr,"Cannot open %s for input.\n", argv[1]);
+    logsteps = trace || tfd != -1;
+
+    /*-------------------------------------------------*/
+    /* Without -j, run each simulation as it is read.  */
+    /*-------------------------------------------------*/
+    if (njobs == 0) {
+        sim = calloc(1,sizeof(struct sim));
+        if (sim == NULL) {
+            fprintf(stderr,"Out of memory.\n");
             exit(1);
         }
-    } else
-        f = stdin;
-
-    for (simno=1;;simno++) {
-        /*---------------------------------*/
-        /* Get the next set of input data. */
-        /*---------------------------------*/
-        if (getinput() != 1)
-            break;
-        t = 0;              /* set simulation time */
-
-        /*---------------------------------*/
-        /* Initialize the data structures. */
-        /*---------------------------------*/
-        for (i=1;i<=np;i++) {       /* initialize each process */
-            proc[i].ip = 0;         /* first action index */
-            proc[i].state = 0;          /* process state is ready */
-            proc[i].runtime = 0;        /* no time used yet */
-            ready[i-1] = i;         /* setup initial ready queue */
-        }
-        nready = np;
-
-        for (i=1;i<=nr;i++) {       /* initialize each resource */
-            rstate[i] = 0;          /* unused */
-            nrw[i] = 0;             /* no waiting processes */
-        }
-
-        printf("Simulation %d\n", simno);
-
-        /*-----------------------------------------------------------*/
-        /* Perform deadlock detection and simulate a process action. */
-        /*-----------------------------------------------------------*/
-        for(;;) {
-            dd = deadlock();        /* check for deadlock */
-            if (dd)         /* if it was detected */
-                break;
-
-            /*---------------------------------------------*/
-            /* Get a process from the ready queue to run.  */
-            /* If there are no ready processes, we must be */
-            /* done or deadlocked.                         */
-            /*---------------------------------------------*/
-            if (nready == 0) break;     /* no ready processes */
-            running = ready[0];         /* first ready process */
-            for (i=1;i<nready;i++)      /* slow queue removal, */
-                ready[i-1] = ready[i];      /* but who cares? */
-            nready--;
-
-            /*--------------------------------------*/
-            /* Get ip, a, and n for running process */
-            /*--------------------------------------*/
-            ip = proc[running].ip;
-            a = proc[running].a[ip];
-            n = proc[running].n[ip];
-
-            if (trace) {
-                printf("%d: ", t);
-                printf("process %d: ", running);
-                printf("%c%d\n", a, n);
-            }
-
-            /*--------------------------------------------*/
-            /* If the process is requesting a resource... */
-            /*--------------------------------------------*/
-            if (a == 'L') {
-                /*------------------------------*/
-                /* If the resource is available */
-                /*------------------------------*/
-                if (rstate[n] == 0) {
-                    if (trace) printf("\t(resource %d allocated to process %d)\n", n, running);
-
-                    rstate[n] = running; /* allocate resource to process */
-
-                    /* increment process runtime */
-                    proc[running].runtime++;
-                    proc[running].ip++;
-                    makeready(running);
-                    t++;
-
-                /*-----------------------------------*/
-                /* If the resource is not available. */
-                /* Time does NOT increase here!      */
-                /*-----------------------------------*/
-                } else {
-                    if (trace) printf("\t(resource %d unavailable)\n", n);
-                    makewait(running,n);        /* add to waiters */
-                    proc[running].state = n;        /* mark proc blocked */
-                }
-            }
-
-            /*-------------------------------------------*/
-            /* If the process is releasing a resource... */
-            /*-------------------------------------------*/
-            else if (a == 'U') {
-                rstate[n] = 0;      /* resource unused now */
-                if (trace) printf("\t(resource %d released)\n", n);
-
-                /*---------------------------------------------*/
-                /* If any processes are waiting on the resource */
-                /*---------------------------------------------*/
-                if (nrw[n] > 0) {
-                    if (trace) printf("\t(process %d unblocked)\n", rw[n][0]);
-
-                    makeready(rw[n][0]); /* make first waiting process ready */
-
-                    /* remove waiting process from resource queue */
-                    for (i=1;i<nrw[n];i++)
-                        rw[n][i-1] = ready[i];
-                    nrw[n]--;
-                }
-
-                /*----------------------------------------*/
-                /* The currently running process advances */
-                /*----------------------------------------*/
-                if (ip+1 == proc[running].ns) {
-                    proc[running].state = -1;       /* done */
-                    proc[running].endtime = t+1;    /* end time */
-                    if (trace) printf("\t(process %d terminated)\n", running);
-                } else {
-                    proc[running].ip++;
-                    makeready(running);
-                }
-                proc[running].runtime++;
-                t++;
-            }
-
-            /*-------------------------------*/
-            /* If the process is "computing" */
-            /*-------------------------------*/
-            else if (a == 'C') {
-                n--; /* reduce remaining computation time */
-
-                /*----------------------------------------*/
-                /* The currently running process advances */
-                /*----------------------------------------*/
-                if (n == 0 && ip+1 == proc[running].ns) {
-                    proc[running].state = -1;       /* done */
-                    proc[running].endtime = t+1;    /* end time */
-                    if (trace) printf("\t(process %d terminated)\n", running);
-                } else {
-                    if (n == 0) {
-                        proc[running].ip++;
-                    } else {
-                        proc[running].n[ip] = n;
-                    }
-                    makeready(running);
-                }
-                proc[running].runtime++;
-                t++;
-            }
-
-            /*----------------------------------------------------------*/
-            /* This point should never be reached if the data is valid. */
-            /*----------------------------------------------------------*/
-            else {
-                fprintf(stderr,"Bad action (%d)\n", a);
+        sim->out = stdout;
+        for (sim->simno=1;getinput(sim)==1;sim->simno++) {
+            if (simulate(sim) != 0) {
+                fflush(stdout);
+                fputs(sim->err,stderr);
                 exit(1);
             }
         }
+        if (tfd != -1)
+            tflush(sim);
+        fflush(stdout);
+        fclose(errout);
+        fwrite(ebuf,1,elen,stderr);
+        return 0;
+    }
 
-        if (!dd) {
-            /*----------------*/
-            /* If no deadlock */
-            /*----------------*/
-            printf("All processes successfully terminated.\n");
-            for (i=1;i<=np;i++) {
-                printf("Process %d: run time = %d, ended at %d\n",
-                       i, proc[i].runtime, proc[i].endtime);
-            }
+    /*-------------------------------------------------------*/
+    /* Otherwise start the workers, and give them each       */
+    /* simulation as it is read, writing the results of the  */
+    /* earlier ones whenever they are ready.                 */
+    /*-------------------------------------------------------*/
+    nslot = 4 * njobs;
+    slot = calloc(nslot,sizeof(struct sim *));
+    tid = calloc(njobs,sizeof(pthread_t));
+    if (slot == NULL || tid == NULL) {
+        fprintf(stderr,"Out of memory.\n");
+        exit(1);
+    }
+    for (i=0;i<nslot;i++) {
+        slot[i] = calloc(1,sizeof(struct sim));
+        if (slot[i] == NULL) {
+            fprintf(stderr,"Out of memory.\n");
+            exit(1);
         }
+    }
+    for (i=0;i<njobs;i++) {
+        if (pthread_create(&tid[i],NULL,worker,NULL) != 0) {
+            fprintf(stderr,"Cannot create a thread.\n");
+            exit(1);
+        }
+    }
+    atexit(putall);
 
-        putchar('\n');
+    for (;;) {
+        while ((i = putnext(0)) > 0)
+            ;
+        if (i == 0 && nread - nout == nslot)    /* next slot in use */
+            i = putnext(1);
+        if (i < 0)
+            exit(1);
+        sim = slot[(nread+1) % nslot];
+        sim->simno = nread + 1;
+        if (getinput(sim) != 1)
+            break;
+        pthread_mutex_lock(&lock);
+        nread++;
+        pthread_cond_broadcast(&change);
+        pthread_mutex_unlock(&lock);
     }
+
+    pthread_mutex_lock(&lock);
+    eof = 1;
+    pthread_cond_broadcast(&change);
+    pthread_mutex_unlock(&lock);
+    for (i=0;i<njobs;i++)
+        pthread_join(tid[i],NULL);
+    putall();
+    fclose(errout);
+    if (!failed)
+        fwrite(ebuf,1,elen,stderr);
+    return failed;
 }
@@ -0,0 +1,134 @@
+/*--------------------------------------------------------------------*/
+/* Trace decoder for prog2.                                           */
+/*                                                                    */
+/* Usage:    prog2_trace tracefile [outputfile]                       */
+/*                                                                    */
+/* Display a trace file written by prog2 -T in the same form as the   */
+/* trace displayed by prog2 -v. If outputfile (what prog2 -T wrote to */
+/* the standard output) is given, the rest of the output of each      */
+/* simulation is displayed with its trace, so the result is the same  */
+/* as the output of prog2 -v; otherwise only the "Simulation" lines   */
+/* and the trace are displayed.                                       */
+/*--------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*------------------------------------------------------------------*/
+/* A record in the trace file, for one event in a simulation. These */
+/* definitions must be the same as those in prog2 (main.c).         */
+/*------------------------------------------------------------------*/
+#define TMAGIC "prog2tr1"
+
+struct trec {
+    int t;      /* simulation time */
+    int p;      /* process (or simulation # in a TSIM record) */
+    int v;      /* value for the action, or resource */
+    char kind;      /* kind of event (below) */
+    char a;     /* the action (L, U or C) in a TSTEP record */
+    char pad[2];
+};
+
+#define TSIM 1      /* start of simulation p */
+#define TSTEP 2     /* process p takes action a with value v */
+#define TALLOC 3    /* resource v allocated to process p */
+#define TUNAVAIL 4  /* resource v unavailable */
+#define TRELEASE 5  /* resource v released */
+#define TUNBLOCK 6  /* process p unblocked */
+#define TTERM 7     /* process p terminated */
+
+#define NREC 65536  /* # of records read at a time */
+
+FILE *of;       /* prog2's output, or NULL */
+
+/*------------------------------------------------------------------*/
+/* Copy lines from prog2's output up to (and, if found, including)  */
+/* the line "Simulation n"; with n = 0, copy all the rest.          */
+/*------------------------------------------------------------------*/
+void copyto(int n)
+{
+    char line[256];
+    int k, bol;         /* bol: line is at the beginning of a line */
+
+    if (of == NULL) {
+        if (n > 0)
+            printf("Simulation %d\n", n);
+        return;
+    }
+    bol = 1;
+    while (fgets(line,sizeof(line),of) != NULL) {
+        fputs(line,stdout);
+        if (bol && n > 0 && sscanf(line,"Simulation %d",&k) == 1 && k == n)
+            return;
+        bol = strchr(line,'\n') != NULL;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    FILE *tf;
+    char magic[8];
+    struct trec *rec, *r;
+    size_t n, i;
+
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr,"Usage: prog2_trace tracefile [outputfile]\n");
+        exit(1);
+    }
+    tf = fopen(argv[1],"rb");
+    if (tf == NULL) {
+        fprintf(stderr,"Cannot open %s for input.\n", argv[1]);
+        exit(1);
+    }
+    if (fread(magic,1,8,tf) != 8 || memcmp(magic,TMAGIC,8) != 0) {
+        fprintf(stderr,"%s is not a prog2 trace file.\n", argv[1]);
+        exit(1);
+    }
+    if (argc == 3) {
+        of = fopen(argv[2],"r");
+        if (of == NULL) {
+            fprintf(stderr,"Cannot open %s for input.\n", argv[2]);
+            exit(1);
+        }
+    }
+    rec = malloc(NREC * sizeof(struct trec));
+    if (rec == NULL) {
+        fprintf(stderr,"Out of memory.\n");
+        exit(1);
+    }
+
+    while ((n = fread(rec,sizeof(struct trec),NREC,tf)) > 0) {
+        for (i=0;i<n;i++) {
+            r = &rec[i];
+            switch (r->kind) {
+                case TSIM:
+                    copyto(r->p);
+                    break;
+                case TSTEP:
+                    printf("%d: process %d: %c%d\n", r->t, r->p, r->a, r->v);
+                    break;
+                case TALLOC:
+                    printf("\t(resource %d allocated to process %d)\n",
+                           r->v, r->p);
+                    break;
+                case TUNAVAIL:
+                    printf("\t(resource %d unavailable)\n", r->v);
+                    break;
+                case TRELEASE:
+                    printf("\t(resource %d released)\n", r->v);
+                    break;
+                case TUNBLOCK:
+                    printf("\t(process %d unblocked)\n", r->p);
+                    break;
+                case TTERM:
+                    printf("\t(process %d terminated)\n", r->p);
+                    break;
+                default:
+                    fprintf(stderr,"Bad trace record (kind %d)\n", r->kind);
+                    exit(1);
+            }
+        }
+    }
+    copyto(0);
+    return 0;
+}